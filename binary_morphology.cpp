@@ -23,6 +23,8 @@
 
 #include "salamander.h"
 #include "files.h"
+#include "frames.h"
+#include "mask.h"
 #include "opencv2/imgproc/imgproc.hpp"
 #include "opencv2/highgui/highgui.hpp"
 #include "highgui.h"
@@ -61,19 +63,24 @@ int main(int argc, const char **argv)
     options.erode = erode_factor; 
     options.dilate = dilate_factor;
     options.shrink_factor = 1; 
+    options.threads = processors(); 
 
     /* get file names */
     std::vector<std::string> names; 
-    filenames( names, std::cin );
+    filenames( names, std::cin, options.threads );
+    FileFrameSource source( names, options ); 
+    FrameBuffer frames( source, 2, options.threads ); 
     char outname [256];
     cv::Mat im;        
+    BitMask mask; 
 
     try 
     {
         for( i = 1; i < names.size(); i ++ ) {
             sprintf(outname, "binmorph%d.jpg", i);
-            delta(im, names[i-1].c_str(), names[i].c_str(), true, options);
-            morphology( im, options );
+            delta(mask, frames, i-1, i, options);
+            morphology( mask, options );
+            mask.toMat( im ); 
             cv::imwrite( outname, im );
         }
     }
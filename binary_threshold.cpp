@@ -24,6 +24,7 @@
 
 #include "salamander.h"
 #include "files.h"
+#include "frames.h"
 #include <iostream>
 
 int main(int argc, const char **argv) 
@@ -49,10 +50,13 @@ int main(int argc, const char **argv)
     options.low = low; 
     options.high = high; 
     options.shrink_factor = 1; 
+    options.threads = processors(); 
 
     /* get file names */
     std::vector<std::string> names; 
-    filenames( names, std::cin );
+    filenames( names, std::cin, options.threads );
+    FileFrameSource source( names, options ); 
+    FrameBuffer frames( source, 2, options.threads ); 
     char outname [256];
         
     try 
@@ -60,7 +64,7 @@ int main(int argc, const char **argv)
         for( i = 1; i < names.size(); i ++ ) {
             sprintf(outname, "binthresh%d.jpg", i);
             cv::Mat im;
-            delta(im, names[i-1].c_str(), names[i].c_str(), threshold, options);
+            delta(im, frames, i-1, i, threshold, options);
             cv::imwrite( outname, im );
         }
     }
@@ -24,11 +24,43 @@
 
 #include "salamander.h"
 #include "blobs.h"
+#include "mask.h"
+#include "runs.h"
 #include <iostream>
+#include <pthread.h>
 
 #define min(x,y) (x < y ? x : y)
 #define max(x,y) (x < y ? y : x)
 
+/* Smallest strip worth a thread of its own, in pixels */ 
+#define STRIP_PIXELS (1 << 18)
+
+template <class job_t> 
+static void parallel( std::vector<job_t> &jobs, void *(*fn)(void*) )
+/* Run fn on each job, the first on this thread and the rest on threads of
+ * their own, and wait for them all. */ 
+{
+  if (jobs.size() == 1) {
+    fn(&jobs[0]); 
+    return; 
+  }
+  std::vector<pthread_t> workers(jobs.size()); 
+  for (int t = 1; t < jobs.size(); t++) 
+    pthread_create(&workers[t], NULL, fn, &jobs[t]); 
+  fn(&jobs[0]); 
+  for (int t = 1; t < jobs.size(); t++) 
+    pthread_join(workers[t], NULL); 
+} // parallel()
+
+static int stripCount( int rows, int cols, int threads )
+/* Number of strips to cut an image into for threads. */ 
+{
+  int n = (long)rows * cols / STRIP_PIXELS; 
+  n = min(n, threads); 
+  n = min(n, rows); 
+  return max(n, 1); 
+} // strips()
+
 Blob::Blob() {
   frame_width = frame_height = 0; 
   bbox[0] = 0;
@@ -91,6 +123,26 @@ Blob Blob::operator*(int scale) const
   newBlob.bbox[3] = min(newBlob.frame_height-1, bbox[3]*scale);  
   return newBlob; 
 } // operator* 
+
+void Blob::fromWindow( const cv::Rect &window, int width, int height ) 
+/* Move a blob found in a window of a width x height frame to the frame's
+ * coordinates. */ 
+{
+  frame_width = width; 
+  frame_height = height; 
+  shift(window.y, window.x); 
+} // fromWindow()
+
+void Blob::shift( int di, int dj ) 
+/* Move by di rows and dj columns. */ 
+{
+  bbox[0] += dj; 
+  bbox[1] += dj; 
+  bbox[2] += di; 
+  bbox[3] += di; 
+  centroid_x += di;        /* centroid_x is the row */ 
+  centroid_y += dj; 
+} // shift()
   
 Blob& Blob::operator=(const Blob &blob) 
 {
@@ -317,69 +369,99 @@ bool Blob::containsPoint( int x, int y ) const
 
 
 
-ConnectedComponents::ConnectedComponents( const cv::Mat &anImage )
+void component_t::reset( int rows, int cols ) 
 {
-  CV_Assert(anImage.depth() == CV_8U);  // accept only uchar images
-  CV_Assert(anImage.channels() == 1);   // just one channel
+  bbox[0] = cols-1; 
+  bbox[1] = 0; 
+  bbox[2] = rows-1; 
+  bbox[3] = 0; 
+  volume = 0; 
+  sum_i = sum_j = 0; 
+  this->rows = rows; 
+  this->cols = cols; 
+} // reset()
 
-  img = anImage.clone();
-  rows = img.rows; 
-  cols = img.cols;
-  components_ct = 0; 
-  
-  labels = new label_t [rows * cols]; 
-  components = new component_t [MAXCOMPS]; 
+void component_t::add( int i, int start, int end ) 
+{
+  int len = end - start + 1; 
+  volume += len; 
+  bbox[0] = min(bbox[0], start); 
+  bbox[1] = max(bbox[1], end); 
+  bbox[2] = min(bbox[2], i); 
+  bbox[3] = max(bbox[3], i); 
+  sum_i += (long long)i * len; 
+  sum_j += (long long)(start + end) * len / 2; 
+} // add()
+
+void component_t::merge( const component_t &c ) 
+{
+  volume += c.volume; 
+  bbox[0] = min(bbox[0], c.bbox[0]); 
+  bbox[1] = max(bbox[1], c.bbox[1]); 
+  bbox[2] = min(bbox[2], c.bbox[2]); 
+  bbox[3] = max(bbox[3], c.bbox[3]); 
+  sum_i += c.sum_i; 
+  sum_j += c.sum_j; 
+} // merge()
+
+void component_t::blob( Blob &b ) const 
+{
+  b = Blob(); 
+  for (int k = 0; k < 4; k++) 
+    b.bbox[k] = bbox[k]; 
+  b.frame_width = cols; 
+  b.frame_height = rows; 
+  b.volume = volume; 
+  b.centroid_x = sum_i / volume; 
+  b.centroid_y = sum_j / volume; 
+} // blob()
 
-  int nrows = img.rows;
-  int ncols = img.cols;
 
-  if (img.isContinuous())
-  {
-    ncols *= nrows;
-    nrows = 1;
-  }
 
-  // populate label matrix
-  int i, j, ct, label = 0; 
-  uchar* p;
-  for (i = 0; i < nrows; ++i)
-  {
-    label_t &q = labels[i * cols + j]; 
-    p = img.ptr<uchar>(i);
-    for (j = 0; j < ncols; ++j)
-    {
-      labels[i * cols + j].pixel = p[j];
-    }
-  }
-  
-  // perform connected component analysis
-  ccomp(); 
-  
+
+ConnectedComponents::ConnectedComponents()
+{
+  rows = cols = 0; 
+} // constr
+
+ConnectedComponents::ConnectedComponents( const cv::Mat &anImage, int min_volume,
+                                          int threads )
+{
+  label( anImage, min_volume, threads ); 
 } // constr
 
-ConnectedComponents::~ConnectedComponents() 
+void ConnectedComponents::label( const cv::Mat &anImage, int min_volume,
+                                 int threads )
 {
-  delete [] labels;
-  delete [] components;
-} // destr
+  CV_Assert(anImage.depth() == CV_8U);  // accept only uchar images
+  CV_Assert(anImage.channels() == 1);   // just one channel
+
+  rows = anImage.rows; 
+  cols = anImage.cols;
+  labels.resize((size_t)rows * cols); 
+
+  // perform connected component analysis
+  ccomp( anImage, min_volume, threads ); 
   
+} // label()
+
 /* Component accessors */ 
 Blob &ConnectedComponents::operator[] (int i) 
 {
-  assert(i >= 0 && i < components_ct); 
-  return components[i].blob; 
+  assert(i >= 0 && i < components.size()); 
+  return components[i]; 
 } // operator[]
 
 const Blob &ConnectedComponents::operator[] (int i) const
 {
-  assert(i >= 0 && i < components_ct); 
-  return components[i].blob; 
+  assert(i >= 0 && i < components.size()); 
+  return components[i]; 
 } // operator[] const 
 
 int ConnectedComponents::size() const
 {
-  return components_ct; 
-} // site()
+  return components.size(); 
+} // size()
 
 void ConnectedComponents::disp() const 
 {
@@ -389,43 +471,32 @@ void ConnectedComponents::disp() const
   {
     for (j = 0; j < cols; j++) 
     { 
-      //printf("(%-1d,%-3d):", labels[i * cols +j].x, labels[i * cols + j].y); 
-      if (labels[i * cols +j].label != UNASSIGNED)
-        printf("%2d  ", labels[i * cols + j].label);
+      if (labels[i * cols +j] != UNASSIGNED)
+        printf("%2d  ", labels[i * cols + j]);
       else
         printf(" -  "); 
     }
     printf("\n"); 
   }
 
-  for (i = 0; i < components_ct; i++) 
-    printf("%d (%d, %d) vol=%d blob.bbox=[%d, %d, %d, %d]\n", components[i].label->label, 
-        components[i].blob.centroid_x, components[i].blob.centroid_y, components[i].blob.volume,
-        components[i].blob.bbox[0], components[i].blob.bbox[1], 
-        components[i].blob.bbox[2], components[i].blob.bbox[3] ); 
+  for (i = 0; i < components.size(); i++) 
+    printf("%d (%d, %d) vol=%d blob.bbox=[%d, %d, %d, %d]\n", i, 
+        components[i].centroid_x, components[i].centroid_y, components[i].volume,
+        components[i].bbox[0], components[i].bbox[1], 
+        components[i].bbox[2], components[i].bbox[3] ); 
 } // disp() 
 
 
 cv::Mat& ConnectedComponents::labeled() 
 {
-  int nrows = rows;
-  int ncols = cols;
-
-  if (img.isContinuous())
+  img.create(rows, cols, CV_8UC1); 
+  for (int i = 0; i < rows; ++i)
   {
-    ncols *= nrows;
-    nrows = 1;
-  }
-  int i, j, ct, label = 0; 
-
-  uchar* p;
-  for (i = 0; i < nrows; ++i)
-  {
-    label_t &q = labels[i * cols + j]; 
-    p = img.ptr<uchar>(i);
-    for (j = 0; j < ncols; ++j)
+    uchar *p = img.ptr<uchar>(i);
+    const int *q = &labels[i * cols]; 
+    for (int j = 0; j < cols; ++j)
     {
-      p[j] = (labels[i * cols + j].pixel * 10) % 255; /* FIXME */ 
+      p[j] = q[j] == UNASSIGNED ? 0 : ((q[j] + 1) * 10) % 255; /* FIXME */ 
     }
   }
   return img; 
@@ -437,152 +508,407 @@ void ConnectedComponents::write( const char *fn )
 } // write()
 
 
-void ConnectedComponents::ccomp() 
+void ConnectedComponents::ccomp( const cv::Mat &img, int min_volume, int threads ) 
+/* Label each strip, then join the labels of the first row of each strip
+ * to the ones they touch in the last row of the strip above. Labels are
+ * numbered in raster order over the whole image. A component's first 
+ * pixel gets a new label, the least of any in the component, so numbering
+ * roots in the order of their least labels numbers components in the 
+ * raster order of their first pixels. Then each strip relabels its pixels
+ * with their components and sums up their features. Components too small
+ * to keep are dropped only after that, so the ones kept come out in the 
+ * same order. */ 
 {
-  int i, j, ct, label = 0; 
-  label_t *neighbors [8]; 
-  
-  // first pass label 
-  for (i = 0; i < rows; i++) 
+  int i, j, s, n = stripCount(rows, cols, threads); 
+
+  strips.resize(n); 
+  for (s = 0; s < n; s++) {
+    strips[s].cc = this; 
+    strips[s].img = &img; 
+    strips[s].begin = (long)rows * s / n; 
+    strips[s].end = (long)rows * (s+1) / n; 
+    strips[s].pass = 1; 
+  }
+  parallel(strips, work); 
+
+  // gather the labels of every strip 
+  forest.parent.clear(); 
+  forest.rank.clear(); 
+  for (s = 0; s < n; s++) 
   {
-    for (j = 0; j < cols; j++) 
-    {
-      label_t &q = labels[i * cols + j]; 
-      if (q.pixel > 0)
-      {
-        ct = getneighbors(neighbors, i, j);
-        switch(ct) 
-        {
-          case 0: 
-            q.label = label++;                // root
-            break;
-
-          default: 
-            label_t *min = neighbors[0]; 
-            for (int k = 1; k < ct; k++) 
-            {
-              if (neighbors[k]->label < min->label)
-                min = neighbors[k]; 
-            }
-            q.label  = min->label;             // sibling of min label
-            q.parent = min->parent; 
-
-            for (int k = 0; k < ct; k++)       // neighbors are in the same group
-              _union(q, *neighbors[k]); 
-
-        }
-      }
+    forest_t &f = strips[s].forest; 
+    strips[s].offset = forest.parent.size(); 
+    for (int l = 0; l < f.parent.size(); l++) {
+      forest.parent.push_back(strips[s].offset + f.parent[l]); 
+      forest.rank.push_back(f.rank[l]); 
     }
   }
 
-  // second pass relabel and calculate blob features
-  for (i = 0; i < rows; i++) 
+  // join across strip boundaries
+  for (s = 1; s < n; s++) 
   {
+    i = strips[s].begin; 
+    const int *q = &labels[i * cols], *up = q - cols; 
+    int here = strips[s].offset, above = strips[s-1].offset; 
     for (j = 0; j < cols; j++) 
     {
-      label_t &q = labels[i * cols + j]; 
-      if (q.pixel > 0)
-      {
-        label_t &p = _find( q );
-        if (!p.component) {
-          assert(components_ct < MAXCOMPS); 
-          p.component = &components[components_ct++]; 
-          p.component->blob.bbox[0] = cols-1; 
-          p.component->blob.bbox[1] = 0; 
-          p.component->blob.bbox[2] = rows-1; 
-          p.component->blob.bbox[3] = 0; 
-          p.component->label = &p;
-          p.component->blob.frame_width = cols; 
-          p.component->blob.frame_height = rows; 
-        }
-        component_t &c = *p.component;
-        c.blob.volume ++;
-        c.blob.bbox[0] = min(c.blob.bbox[0], j); 
-        c.blob.bbox[1] = max(c.blob.bbox[1], j); 
-        c.blob.bbox[2] = min(c.blob.bbox[2], i); 
-        c.blob.bbox[3] = max(c.blob.bbox[3], i);
-        c.blob.centroid_x += i; 
-        c.blob.centroid_y += j; 
-        q.label = p.label;
-        q.pixel = p.label % 255; /* FIXME */ 
-      }
+      if (q[j] == UNASSIGNED) 
+        continue; 
+      for (int k = max(0, j-1); k <= min(cols-1, j+1); k++) 
+        if (up[k] != UNASSIGNED) 
+          forest._union(here + q[j], above + up[k]); 
     }
   }
 
-  // centroid calculation
-  for (i = 0; i < components_ct; i++) {
-    components[i].blob.centroid_x /= components[i].blob.volume; 
-    components[i].blob.centroid_y /= components[i].blob.volume; 
+  // number the components
+  int ct = 0; 
+  index.assign(forest.parent.size(), UNASSIGNED); 
+  for (int l = 0; l < forest.parent.size(); l++) 
+  {
+    int root = forest._find(l); 
+    if (index[root] == UNASSIGNED) {
+      if (ct == pool.size()) 
+        pool.push_back(component_t()); 
+      pool[ct].reset(rows, cols); 
+      index[root] = ct++; 
+    }
+    index[l] = index[root]; 
   }
-  
-} // ccomp() 
 
+  // relabel and sum up features
+  for (s = 0; s < n; s++) 
+    strips[s].pass = 2; 
+  parallel(strips, work); 
 
+  for (s = 0; s < n; s++) 
+  {
+    strip_t &strip = strips[s]; 
+    for (int l = 0; l < strip.forest.parent.size(); l++) 
+      if (strip.forest.parent[l] == l) 
+        pool[index[strip.offset + l]].merge(strip.pool[l]); 
+  }
 
-void ConnectedComponents::_union (label_t &a, label_t &b)
-{
+  components.clear(); 
+  for (i = 0; i < ct; i++) 
+    if (pool[i].volume >= min_volume) {
+      components.push_back(Blob()); 
+      pool[i].blob(components.back()); 
+    }
+  
+} // ccomp() 
 
-  /* TODO This be done in O(1) if we maintain the rank of each node in the tree. 
-   * Here we must traverse to the root for each union operation. */ 
+void *ConnectedComponents::work( void *arg ) 
+{
+  strip_t *strip = (strip_t *)arg; 
+  if (strip->pass == 1) 
+    strip->cc->scan(*strip); 
+  else 
+    strip->cc->collect(*strip); 
+  return NULL; 
+} // work()
+
+void ConnectedComponents::scan( strip_t &strip ) 
+/* Give each foreground pixel of the strip a provisional label from its 
+ * neighbors above and to the left, 
+ *
+ *   a b c 
+ *   d x 
+ *
+ * deciding which ones to look at with a decision tree: b touches all of 
+ * the others, so if it's set, x takes its label and nothing needs to be 
+ * merged. Otherwise c and a, or c and d, may be separate and have to be
+ * merged. The first row of a strip doesn't look above. */ 
+{
+  int i, j; 
+  forest_t &f = strip.forest; 
+  f.parent.clear(); 
+  f.rank.clear(); 
+  
+  for (i = strip.begin; i < strip.end; i++) 
+  {
+    const uchar *p = strip.img->ptr<uchar>(i); 
+    int *q = &labels[i * cols]; 
+    const int *up = i > strip.begin ? q - cols : NULL; 
 
-  label_t *A = a.parent, *B = b.parent, *prev; 
-  int rankA = 0, rankB = 0; 
+    for (j = 0; j < cols; j++) 
+    {
+      if (!p[j]) {
+        q[j] = UNASSIGNED; 
+        continue; 
+      }
 
-  prev = &a; 
-  while (A) {
-    prev = A; 
-    A = A->parent; 
-    rankA ++; 
+      int a = (up && j > 0) ? up[j-1] : UNASSIGNED, 
+          b = up ? up[j] : UNASSIGNED, 
+          c = (up && j + 1 < cols) ? up[j+1] : UNASSIGNED, 
+          d = j > 0 ? q[j-1] : UNASSIGNED; 
+
+      if (b != UNASSIGNED) 
+        q[j] = b; 
+      else if (c != UNASSIGNED) {
+        q[j] = c; 
+        if (a != UNASSIGNED) 
+          f._union(c, a); 
+        else if (d != UNASSIGNED) 
+          f._union(c, d); 
+      }
+      else if (a != UNASSIGNED) 
+        q[j] = a; 
+      else if (d != UNASSIGNED) 
+        q[j] = d; 
+      else 
+        q[j] = f._new();                // root 
+    }
   }
-  A = prev;
-  
-  prev = &b; 
-  while (B) {
-    prev = B; 
-    B = B->parent; 
-    rankB ++; 
+} // scan()
+
+void ConnectedComponents::collect( strip_t &strip ) 
+/* Sum up features under the strip's own root labels, a run of pixels at a
+ * time, and relabel the pixels with their components. */ 
+{
+  forest_t &f = strip.forest; 
+  for (int l = 0; l < f.parent.size(); l++) { 
+    if (l == strip.pool.size()) 
+      strip.pool.push_back(component_t()); 
+    strip.pool[l].reset(rows, cols); 
   }
-  B = prev;
-  
-  if (A != B)
+
+  for (int i = strip.begin; i < strip.end; i++) 
   {
-    if (rankA < rankB) 
-      A->parent = B; 
-  
-    else
-      B->parent = A; 
+    int *q = &labels[i * cols]; 
+    for (int j = 0; j < cols; ) 
+    {
+      if (q[j] == UNASSIGNED) {
+        j++; 
+        continue; 
+      }
+      int l = q[j], start = j; 
+      for (; j < cols && q[j] == l; j++) 
+        q[j] = index[strip.offset + l]; 
+      strip.pool[f._find(l)].add(i, start, j - 1); 
+    }
+  }
+} // collect()
+
+
+int ConnectedComponents::forest_t::_new ()
+{
+  parent.push_back(parent.size()); 
+  rank.push_back(0); 
+  return parent.size() - 1; 
+} // _new()
+
+void ConnectedComponents::forest_t::_union (int a, int b)
+/* Union by rank. */ 
+{
+  a = _find(a); 
+  b = _find(b); 
+  if (a == b) 
+    return; 
+
+  if (rank[a] < rank[b]) 
+    parent[a] = b; 
+  else if (rank[b] < rank[a]) 
+    parent[b] = a; 
+  else {
+    parent[b] = a; 
+    rank[a]++; 
   }
 } // _union()
 
-ConnectedComponents::label_t &ConnectedComponents::_find (label_t &a) const
+int ConnectedComponents::forest_t::_find (int a) 
+/* Path compression: hang every label on the way directly from the root. */ 
 {
-  label_t *A = a.parent, *prev; 
-  prev = &a; 
-  while (A) {
-    prev = A;
-    A = A->parent; 
+  int root = a; 
+  while (parent[root] != root) 
+    root = parent[root]; 
+  while (parent[a] != root) {
+    int next = parent[a]; 
+    parent[a] = root; 
+    a = next; 
   }
-  A = prev; 
-  return *A;  
+  return root; 
 } // _find()
 
-int ConnectedComponents::getneighbors(label_t* neighbors [], int i, int j) 
+
+
+
+MaskComponents::MaskComponents() 
+{
+} // constr
+
+MaskComponents::MaskComponents( const BitMask &mask, int min_volume, 
+                                int threads ) 
 {
-  int ct = 0;
+  label( mask, min_volume, threads ); 
+} // constr
 
-  //printf("(%d, %d) ", i, j); 
-  for (int x = max(0, i-1); x <= min(i+1, rows-1); x++)
-  {
-    for (int y = max(0, j-1); y <= min(j+1, cols-1); y++)
-    {
-      if (labels[x * cols + y].label != UNASSIGNED) {
-        //cout << labels[x * cols + y].label << ' '; 
-        neighbors[ct++] = &labels[x * cols + y];
-      }
+void MaskComponents::label( const BitMask &mask, int min_volume, int threads ) 
+/* Find the runs of each strip, then join the runs of the first row of each
+ * strip to the ones they touch in the last row of the strip above. */ 
+{
+  int rows = mask.rows(), cols = mask.cols(), s, n; 
+  n = stripCount(rows, cols, threads); 
+
+  strips.resize(n); 
+  for (s = 0; s < n; s++) {
+    strips[s].mask = &mask; 
+    strips[s].begin = (long)rows * s / n; 
+    strips[s].end = (long)rows * (s+1) / n; 
+  }
+  parallel(strips, scan); 
+
+  runs.clear(); 
+  for (s = 0; s < n; s++) {
+    strip_t &strip = strips[s]; 
+    strip.offset = runs.size(); 
+    for (int r = 0; r < strip.runs.size(); r++) {
+      runs.push_back(strip.runs[r]); 
+      runs.back().parent += strip.offset; 
     }
+    if (s > 0) 
+      join(runs, strips[s-1].offset + strips[s-1].last, strip.offset, 
+                 strip.offset + strip.first); 
   }
-  //cout << endl;
-  
-  return ct; 
-} // getneighbors()
 
+  number(rows, cols, min_volume); 
+} // label()
+
+void MaskComponents::label( const RunMask &mask, int min_volume ) 
+/* The runs are already there; join each row's to the row above. */ 
+{
+  int rows = mask.rows(), cols = mask.cols(), above = 0, here = 0; 
+  runs.clear(); 
+  for (int i = 0; i < rows; i++) {
+    above = here; 
+    here = runs.size(); 
+    for (const RunMask::run_t *q = mask.begin(i); q != mask.end(i); q++) {
+      run_t r = { i, q->start, q->end, (int)runs.size() }; 
+      runs.push_back(r); 
+    }
+    if (i > 0) 
+      join(runs, above, here, runs.size()); 
+  }
+  number(rows, cols, min_volume); 
+} // label()
+
+void MaskComponents::number( int rows, int cols, int min_volume ) 
+/* Runs are in raster order, so numbering the components in the order 
+ * their first runs are seen numbers them in the order of their first 
+ * pixels, like ConnectedComponents does. Sum up their features, then keep
+ * the ones that are big enough. */ 
+{
+  int ct = 0; 
+  index.assign(runs.size(), -1); 
+  for (int r = 0; r < runs.size(); r++) {
+    int root = _find(runs, r); 
+    if (index[root] < 0) {
+      if (ct == pool.size()) 
+        pool.push_back(component_t()); 
+      pool[ct].reset(rows, cols); 
+      index[root] = ct++; 
+    }
+    const run_t &q = runs[r]; 
+    pool[index[root]].add(q.row, q.start, q.end); 
+  }
+
+  blobs.clear(); 
+  for (int i = 0; i < ct; i++) 
+    if (pool[i].volume >= min_volume) {
+      blobs.push_back(Blob()); 
+      pool[i].blob(blobs.back()); 
+    }
+} // number()
+
+Blob &MaskComponents::operator[] (int i) 
+{
+  assert(i >= 0 && i < blobs.size()); 
+  return blobs[i]; 
+} // operator[]
+
+const Blob &MaskComponents::operator[] (int i) const
+{
+  assert(i >= 0 && i < blobs.size()); 
+  return blobs[i]; 
+} // operator[] const 
+
+int MaskComponents::size() const
+{
+  return blobs.size(); 
+} // size()
+
+void MaskComponents::sink_t::operator() ( int start, int end ) 
+{
+  run_t r = { row, start, end, (int)runs->size() }; 
+  runs->push_back(r); 
+} // operator()
+
+void *MaskComponents::scan( void *arg ) 
+/* Find the runs of each row, and join each with the runs of the row above
+ * that overlap it or touch it diagonally. The first row of a strip doesn't
+ * look above. */ 
+{
+  strip_t &strip = *(strip_t *)arg; 
+  std::vector<run_t> &runs = strip.runs; 
+  const BitMask &mask = *strip.mask; 
+  int cols = mask.cols(), n = mask.words(); 
+  int above = 0, here = 0;      /* first run of the row above, this row */ 
+  sink_t sink = { &runs, 0 }; 
+  runs.clear(); 
+
+  for (int i = strip.begin; i < strip.end; i++) {
+    above = here; 
+    here = runs.size(); 
+    sink.row = i; 
+    BitMask::runs(mask.row(i), n, cols, sink); 
+
+    if (i > strip.begin) 
+      join(runs, above, here, runs.size()); 
+    else 
+      strip.first = runs.size(); 
+  }
+  strip.last = here; 
+  return NULL; 
+} // scan()
+
+void MaskComponents::join( std::vector<run_t> &runs, int above, int here, 
+                                                     int end ) 
+/* Both rows are sorted, so walk them together; a run above that ends past
+ * the end of this one may touch the next one too. */ 
+{
+  int a = above, b = here; 
+  while (a < here && b < end) {
+    if (runs[a].end + 1 < runs[b].start) 
+      a++; 
+    else if (runs[b].end + 1 < runs[a].start) 
+      b++; 
+    else {
+      _union(runs, a, b); 
+      if (runs[a].end < runs[b].end) 
+        a++; 
+      else 
+        b++; 
+    }
+  }
+} // join()
+
+void MaskComponents::_union (std::vector<run_t> &runs, int a, int b) 
+/* Hang the later root under the earlier one, so a root is always the 
+ * first run of its component. */ 
+{
+  a = _find(runs, a); 
+  b = _find(runs, b); 
+  if (a < b) 
+    runs[b].parent = a; 
+  else if (b < a) 
+    runs[a].parent = b; 
+} // _union()
+
+int MaskComponents::_find (std::vector<run_t> &runs, int a) 
+/* Path halving. */ 
+{
+  while (runs[a].parent != a) {
+    runs[a].parent = runs[runs[a].parent].parent; 
+    a = runs[a].parent; 
+  }
+  return a; 
+} // _find()
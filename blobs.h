@@ -27,13 +27,19 @@
 
 #include "salamander.h"
 #define UNASSIGNED -1
-#define MAXCOMPS 1024
 
 class ConnectedComponents; 
+class MaskComponents; 
+class BitMask; 
+class RunMask; 
+struct component_t; 
 
 class Blob {
 friend std::ostream& operator<< (std::ostream&, const Blob&); 
 friend class ConnectedComponents; 
+friend class MaskComponents; 
+friend struct component_t; 
+friend class Chunks; 
 
   /* Bounding box is used for tracking targets. */
   
@@ -65,6 +71,8 @@ public:
    * features for tracking. */ 
 
   Blob  operator*(int scale) const; 
+  void fromWindow( const cv::Rect &window, int width, int height ); 
+  void shift( int di, int dj ); 
   Blob& operator=(const Blob &blob); 
   bool operator==(const Blob &blob) const; 
   bool operator!=(const Blob &blob) const; 
@@ -92,13 +100,58 @@ public:
 std::ostream& operator<< (std::ostream &out, const Blob &blob); 
 
 
+/**
+ * struct component_t - features of a component, summed up as its pixels
+ * are found. Labelers keep a pool of these, which grows as needed and is
+ * reused from frame to frame, and only make blobs of the components that
+ * are big enough. 
+ */
+
+struct component_t {
+
+  /* Start a component in a frame of rows x cols. */ 
+  void reset( int rows, int cols ); 
+
+  /* Add the pixels of row i from column start to end inclusive. */ 
+  void add( int i, int start, int end ); 
+
+  /* Add the pixels of another part of the same component. */ 
+  void merge( const component_t &c ); 
+
+  /* Blob with the component's bounding box, centroid and volume. */ 
+  void blob( Blob &b ) const; 
+
+  int bbox [4]; 
+  int volume; 
+  long long sum_i, sum_j; 
+  int rows, cols; 
+}; 
+
+
+/**
+ * class ConnectedComponents - connected component analysis of an 8-bit 
+ * image (8-connectivity); pixels that aren't zero are foreground. Each 
+ * pixel gets an int label in a flat plane, and provisional labels are 
+ * merged in an array-based disjoint-set forest with path compression and
+ * union by rank, so labeling takes time linear in the number of pixels. 
+ * Components are numbered in the raster order of their first pixels. 
+ *
+ * Given threads, a large image is cut into horizontal strips that are 
+ * labeled at the same time, and components that cross from one strip to
+ * the next are joined afterwards. The blobs are the same either way. 
+ */ 
+
 class ConnectedComponents
 {
 
 public: 
 
-  ConnectedComponents( const cv::Mat& ); 
-  ~ConnectedComponents(); 
+  ConnectedComponents(); 
+  ConnectedComponents( const cv::Mat&, int min_volume=0, int threads=1 ); 
+
+  /* Label an image, keeping components of at least min_volume pixels, on
+   * up to threads threads. Storage is kept from the last call. */ 
+  void label( const cv::Mat&, int min_volume=0, int threads=1 ); 
   
   /* Write labeled image to file */ 
   void write( const char *fn ); 
@@ -109,35 +162,6 @@ public:
   /* Debugging display */ 
   void disp() const; 
 
-  struct component_t; 
-
-  /* Disjoint-set data structure and cc matrix cell */ 
-  struct label_t {
-    
-    label_t() {
-      label = UNASSIGNED; 
-      parent = NULL; 
-      component = NULL; 
-    }
-
-    uchar pixel; 
-    int   label;
-    label_t *parent;
-    component_t *component; 
-  };
-
-  struct component_t {
-
-    component_t() {
-      label = NULL; 
-      blob.volume = 0; 
-      blob.centroid_x = blob.centroid_y = 0; 
-    }
-
-    label_t *label; 
-    Blob blob; 
-  }; 
-  
   /* Component accessors */ 
   Blob &operator[] (int); 
   const Blob &operator[] (int) const; 
@@ -145,20 +169,115 @@ public:
     
 private:
 
-  /* Disjoint-set methods */
-  void      _union (label_t &a, label_t &b);
-  label_t & _find (label_t &a) const; 
+  /* Disjoint-set forest of labels */
+  struct forest_t {
+    int  _new (); 
+    void _union (int a, int b);
+    int  _find (int a); 
+    std::vector<int> parent, rank; 
+  }; 
+
+  /* Rows begin to end (exclusive) of the image. Labels in the plane are
+   * numbered from 0 in each strip, and from offset in the whole image. */ 
+  struct strip_t {
+    ConnectedComponents *cc; 
+    const cv::Mat *img; 
+    int begin, end, offset, pass; 
+    forest_t forest; 
+    std::vector<component_t> pool; /* features of each root label */ 
+  }; 
     
   /* Connected component analysis */ 
-  int getneighbors(label_t* neighbors [], int i, int j);
-  void ccomp();
+  void ccomp( const cv::Mat&, int min_volume, int threads );
+  void scan( strip_t& ); 
+  void collect( strip_t& ); 
+  static void *work( void *arg ); 
   
-  label_t     *labels; 
-  component_t *components; 
-  int rows, cols, components_ct; 
+  std::vector<int> labels;      /* label plane, UNASSIGNED for background */ 
+  std::vector<strip_t> strips; 
+  forest_t forest;              /* labels of all strips */ 
+  std::vector<int> index;       /* component of each label */ 
+  std::vector<component_t> pool; 
+  std::vector<Blob> components; 
+  int rows, cols; 
   
-  cv::Mat img; 
+  cv::Mat img;                  /* labeled() */ 
    
 }; // class ConnectedComponents
 
+
+/**
+ * class MaskComponents - connected component analysis of a bit mask. 
+ * Runs of set pixels are read a word at a time and joined to the runs 
+ * they touch in the row above (8-connectivity). Components and their 
+ * blobs are the same, and in the same order, as ConnectedComponents 
+ * finds for the equivalent 8-bit image. Like ConnectedComponents, it can
+ * find the runs of horizontal strips of a large mask at the same time. 
+ */ 
+
+class MaskComponents
+{
+
+public: 
+
+  MaskComponents(); 
+  MaskComponents( const BitMask&, int min_volume=0, int threads=1 ); 
+
+  /* Label a mask, keeping components of at least min_volume pixels, on up
+   * to threads threads. Storage is kept from the last call. */ 
+  void label( const BitMask&, int min_volume=0, int threads=1 ); 
+
+  /* Label a mask that's already in runs. */ 
+  void label( const RunMask&, int min_volume=0 ); 
+
+  /* Component accessors */ 
+  Blob &operator[] (int); 
+  const Blob &operator[] (int) const; 
+  int size() const; 
+
+private: 
+
+  struct run_t {
+    int row, start, end;        /* pixels start to end inclusive */ 
+    int parent; 
+  }; 
+
+  /* Rows begin to end (exclusive) of the mask, with runs numbered from 0
+   * in the strip, and from offset in the whole mask. */ 
+  struct strip_t {
+    const BitMask *mask; 
+    int begin, end, offset; 
+    int first, last;            /* end of the first row's runs, start of 
+                                   the last row's */ 
+    std::vector<run_t> runs; 
+  }; 
+
+  /* Appends the runs of a row, for BitMask::runs(). */ 
+  struct sink_t {
+    std::vector<run_t> *runs; 
+    int row; 
+    void operator() ( int start, int end ); 
+  }; 
+
+  /* Find and join the runs of a strip. */ 
+  static void *scan( void *arg ); 
+
+  /* Join the runs [above, here) of one row to [here, end) of the next. */ 
+  static void join( std::vector<run_t> &runs, int above, int here, int end ); 
+
+  /* Number the components of runs and make blobs of the big ones. */ 
+  void number( int rows, int cols, int min_volume ); 
+
+  /* Disjoint-set methods */ 
+  static void _union (std::vector<run_t> &runs, int a, int b); 
+  static int  _find (std::vector<run_t> &runs, int a); 
+
+  std::vector<strip_t> strips; 
+  std::vector<run_t> runs;      /* runs of all strips */ 
+  std::vector<int> index;       /* component of each root run */ 
+  std::vector<component_t> pool; 
+  std::vector<Blob> blobs; 
+
+}; // class MaskComponents
+
 #endif // BLOBS_H
@@ -26,6 +26,9 @@
 #include "chunks.h"
 #include <iostream>
 #include <cstring> 
+#include <algorithm>
+#include <cmath>
+#include <climits>
 #include <assert.h>
 
 TrackException::TrackException(const char *str) {
@@ -40,18 +43,11 @@ std::ostream &operator<<(std::ostream &out, const TrackException &err) {
  * class Chunk
  */
 
-Chunk::Chunk( Chunk *p ) 
-{
-  prev = p; 
-  next = NULL; 
-  gap_known = false; 
-} // constr
-
 Chunk::Chunk() 
 {
-  next = NULL;
-  prev = NULL; 
   gap_known = false; 
+  target = -1; 
+  most = 0; 
 } // constr
 
 bool Chunk::gapKnown() const 
@@ -85,27 +81,50 @@ void Chunk::setEndIndex( int i )
 } // get end_index
 
 void Chunk::setStartPos( const cv::Mat &delta, int i ) 
-/* Set start position for track list. For now, assume there is only 
- * ever one target to watch. */
 {
   std::vector<Blob> blobs; 
-  switch (getBlobs(delta, blobs)) {
+  getBlobs(delta, blobs); 
+  setStartPos(blobs, i); 
+} // setStartPos() 
+
+void Chunk::setStartPos( const std::vector<Blob> &blobs, int i ) 
+/* Set start position for track list. */
+{
+  targets.update(blobs, i); 
+  switch (blobs.size()) {
+    case 0: throw TrackException("no blobs at setStartPos()");    
     case 1: /* There should be only one blob in the delta frame
                at the start of a new chunk. (Of course, assuming
                the previous gap had no target.) */ 
       tracks.push_back(Track(blobs[0], i)); 
       break;
                
-    default: throw TrackException("too many blobs at setStartPos()");    
+    default: { /* Several targets came in at once. Follow the 
+                  largest. */ 
+      int k = 0; 
+      for (int j = 1; j < blobs.size(); j++) 
+        if (blobs[j].GetVolume() > blobs[k].GetVolume()) 
+          k = j; 
+      tracks.push_back(Track(blobs[k], i)); 
+      std::cout << " largest of " << blobs.size() << " " 
+                << tracks.back().blob << std::endl;
+    }
   }
+  retarget(); 
 } // setStartPos() 
 
 void Chunk::setStartPos( const cv::Mat &delta, const Blob &last_known_pos, int i ) 
-/* Set start position for track list given a known previous starting position. 
- * for now, assume there is only ever one target to watch. */
 {
   std::vector<Blob> blobs; 
-  switch (getBlobs(delta, blobs)) {
+  getBlobs(delta, blobs); 
+  setStartPos(blobs, last_known_pos, i); 
+} // setStartPos(lastKnown)
+
+void Chunk::setStartPos( const std::vector<Blob> &blobs, const Blob &last_known_pos, int i ) 
+/* Set start position for track list given a known previous starting position. */
+{
+  targets.update(blobs, i); 
+  switch (blobs.size()) {
     case 2: /* If this is the case, then the blob that isn't 
                the same as end_pos should be the new end_pos. */
       if (last_known_pos.Intersects(blobs[0])) {
@@ -138,16 +157,40 @@ void Chunk::setStartPos( const cv::Mat &delta, const Blob &last_known_pos, int i
         std::cout << " shift over merged(1) " << tracks.back().blob << std::endl;
       }
       break;
-    default: throw TrackException("too many blobs at setStartPos(last_known_pos)");    
+    case 0: throw TrackException("no blobs at setStartPos(last_known_pos)");    
+    default: { /* Several targets. As with two, the target is the one
+                  that moved away from where it was: the nearest blob 
+                  that doesn't intersect it, if there is one. */ 
+      int k = 0; 
+      bool away = !last_known_pos.Intersects(blobs[0]); 
+      for (int j = 1; j < blobs.size(); j++) {
+        bool a = !last_known_pos.Intersects(blobs[j]); 
+        if ((a && !away) || (a == away && 
+            last_known_pos.DistanceTo(blobs[j]) < last_known_pos.DistanceTo(blobs[k]))) {
+          k = j; 
+          away = a; 
+        }
+      }
+      tracks.push_back(Track(blobs[k], i)); 
+      std::cout << " nearest of " << blobs.size() << " " 
+                << tracks.back().blob << std::endl;
+    }
   }
+  retarget(); 
 } // setStartPos(lastKnown)
 
 void Chunk::updateTarget( const cv::Mat &delta, int i ) 
-/* Still processing the same chunk, update track list. For now, assume there 
- * is only ever one target to watch. */
 {
   std::vector<Blob> blobs; 
-  switch (getBlobs(delta, blobs)) {
+  getBlobs(delta, blobs); 
+  updateTarget(blobs, i); 
+} // updateTarget()
+
+void Chunk::updateTarget( const std::vector<Blob> &blobs, int i ) 
+/* Still processing the same chunk, update track list. */
+{
+  targets.update(blobs, i); 
+  switch (blobs.size()) {
     case 2: /* If this is the case, then the blob that isn't 
                the same as end_pos should be the new end_pos. */
       if (tracks.back().blob.Intersects(blobs[0])) {
@@ -180,8 +223,19 @@ void Chunk::updateTarget( const cv::Mat &delta, int i )
         std::cout << " shift over merged(2) " <<  tracks.back().blob << std::endl;
       }
       break;
-    default: throw TrackException("too many blobs at udpateTarget()");    
+    case 0: throw TrackException("no blobs at udpateTarget()");    
+    default: { /* Several targets. Go where the tracker took this one; 
+                  if it wasn't seen in this frame, it stays put. */ 
+      int k = targets.find(target); 
+      if (k >= 0 && targets[k].last == i) 
+        tracks.push_back(Track(targets[k].blob, i)); 
+      else 
+        tracks.push_back(Track(tracks.back().blob, i)); 
+      std::cout << " tracked(" << blobs.size() << ") " 
+                << tracks.back().blob << std::endl;
+    }
   }
+  retarget(); 
 } // updateTarget()
 
 const Blob &Chunk::getStartPos() const 
@@ -199,6 +253,32 @@ const std::vector<Track> &Chunk::getTracks() const
   return tracks; 
 } // getTracks()
 
+Blob Chunk::predict( int i ) const
+/* The track's last position, moved on at its target's velocity. */ 
+{
+  Blob b = tracks.back().blob; 
+  int k = targets.find(target); 
+  if (k >= 0) {
+    int dt = i - tracks.back().index; 
+    b.shift(floor(targets[k].vi * dt + 0.5), floor(targets[k].vj * dt + 0.5)); 
+  }
+  return b; 
+} // predict()
+
+int Chunk::getMostTargets() const
+{
+  return most; 
+} // getMostTargets()
+
+void Chunk::retarget() 
+/* The target nearest to where the track went; usually the one the blob 
+ * it took went to. */ 
+{
+  int k = targets.nearest(tracks.back().blob); 
+  target = k >= 0 ? targets[k].id : -1; 
+  most = std::max(most, targets.confirmed()); 
+} // retarget()
+
 
 std::ostream &operator<<(std::ostream &out, const Chunk &chunk) {
   out << chunk.getStartPos() << std::endl;
@@ -212,103 +292,214 @@ std::ostream &operator<<(std::ostream &out, const Chunk &chunk) {
  * class Chunks 
  */ 
 
+static bool before( int i, const Chunks::chunk_t &c ) 
+{
+  return i < c.start_index; 
+} // before()
+
 Chunks::Chunks( ) 
 {
-  head = tail = NULL;  
-  ct = 0; 
+  frame_width = frame_height = 0; 
+  leaves = 0; 
 } // constr
 
-Chunks::~Chunks() 
+int Chunks::size() const 
 {
-  Chunk *tmp; 
-  while (head != NULL) {
-    tmp = head->next; 
-    delete head; 
-    head = tmp;
-  }
-} // destr
+  return chunks.size(); 
+} // size()
 
-int Chunks::size() const 
+Chunks::const_iterator Chunks::begin() const 
 {
-  return ct; 
-} // get ct 
+  return chunks.begin(); 
+} // begin() 
 
-Chunk *Chunks::start() 
-/* head -> tail iterator */ 
+Chunks::const_iterator Chunks::end() const 
 {
-  curr = head; 
-  return curr; 
-} // start() 
+  return chunks.end(); 
+} // end() 
 
-Chunk *Chunks::next() 
-/* head -> tail iterator */ 
+const Chunks::chunk_t &Chunks::operator[]( int c ) const 
 {
-  if (curr) 
-    curr = curr->next; 
-  return curr;  
-} // next() 
+  return chunks[c]; 
+} // operator[]
 
-Chunk *Chunks::end() 
-/* tail -> head iterator */ 
+int Chunks::tracks() const 
 {
-  curr = tail; 
-  return curr; 
-} // end() 
+  return index.size(); 
+} // tracks()
+
+Track Chunks::track( int k ) const 
+/* Put the columns of row k back together. */ 
+{
+  Blob b; 
+  for (int s = 0; s < 4; s++) 
+    b.bbox[s] = bbox[s][k]; 
+  b.centroid_x = centroid_x[k]; 
+  b.centroid_y = centroid_y[k]; 
+  b.volume = volume[k]; 
+  b.frame_width = frame_width; 
+  b.frame_height = frame_height; 
+  return Track(b, index[k]); 
+} // track()
+
+Blob Chunks::startPos( int c ) const 
+{
+  return track(chunks[c].first).blob; 
+} // startPos()
+
+Blob Chunks::endPos( int c ) const 
+{
+  return track(chunks[c].last - 1).blob; 
+} // endPos()
 
-Chunk *Chunks::prev() {
-/* tail -> head iterator */ 
-  if (curr) 
-    curr = curr->prev; 
-  return curr; 
-} // prev() 
-
-
-Chunk *Chunks::append( Chunk *chunk ) 
-/* Append a chunk to tail. This and mergeWithNext() are the only 
- * mutators for this object. */ 
-{
-  ct ++;
-  if (!head) {
-    head = tail = chunk; 
-  } else {
-    chunk->prev = tail; 
-    tail->next = chunk; 
-    tail = chunk; 
+void Chunks::append( const Chunk &chunk ) 
+/* Append a chunk to the end. This, gapKnown() and merge() are the
+ * only mutators for this object. */ 
+{
+  chunk_t c; 
+  c.start_index = chunk.start_index; 
+  c.end_index = chunk.end_index; 
+  c.first = index.size(); 
+  c.gap_known = false; 
+  c.most = chunk.most; 
+
+  const std::vector<Track> &tracks = chunk.tracks; 
+  if (index.empty() && !tracks.empty()) {
+    frame_width = tracks[0].blob.frame_width; 
+    frame_height = tracks[0].blob.frame_height; 
+  }
+  for (int k = 0; k < tracks.size(); k++) {
+    const Blob &b = tracks[k].blob; 
+    index.push_back(tracks[k].index); 
+    for (int s = 0; s < 4; s++) 
+      bbox[s].push_back(b.bbox[s]); 
+    centroid_x.push_back(b.centroid_x); 
+    centroid_y.push_back(b.centroid_y); 
+    volume.push_back(b.volume); 
+    grow(index.size() - 1); 
   }
-  return tail; 
+  c.last = index.size(); 
+
+  chunks.push_back(c); 
+  gapKnown(chunks.size() - 1, chunk.gap_known); 
 } // append() 
 
-Chunk *Chunks::back() 
-{
-  return tail;
-} // back() 
-
-void Chunks::mergeWithNext(Chunk *chunk) 
-/* Merge this chunk with the next one. This and append() are the only
- * mutators for this object. */ 
-{
-  if (chunk->next) {
-    chunk->end_index = chunk->next->end_index; 
-    const std::vector<Track> &tracks = chunk->next->tracks; 
-    for (int i = 0; i < tracks.size(); i++)
-      chunk->tracks.push_back(tracks[i]);    
-
-    Chunk *del = chunk->next;
-    if (del->prev && del->next) {
-       del->prev->next = del->next;
-       del->next->prev = del->prev;
-    } else if (del->prev) {
-       del->prev->next = del->next;
-       tail = del->prev;
-    } else if (del->next) {
-       del->next->prev = del->prev;
-       head = del->next;
-    }
-    delete del;
+void Chunks::gapKnown( int c, bool k ) 
+{
+  if (chunks[c].gap_known == k) 
+    return; 
+  chunks[c].gap_known = k; 
+  std::vector<int>::iterator it = 
+    std::lower_bound(known.begin(), known.end(), chunks[c].start_index); 
+  if (k) 
+    known.insert(it, chunks[c].start_index); 
+  else 
+    known.erase(it); 
+} // gapKnown()
+
+int Chunks::lastKnown() const 
+{
+  return known.empty() ? -1 : find(known.back()); 
+} // lastKnown()
+
+int Chunks::find( int i ) const 
+{
+  return std::upper_bound(chunks.begin(), chunks.end(), i, before) - 
+         chunks.begin() - 1; 
+} // find()
+
+void Chunks::grow( int k ) 
+/* The tree is a heap, root at 1 and leaves from leaves on. Leaves past 
+ * the last track are empty, and neither intersect nor miss anything. 
+ * When it runs out of leaves, it is built again twice as big. */ 
+{
+  node_t empty; 
+  for (int s = 0; s < 4; s++) {
+    empty.lo[s] = INT_MAX; 
+    empty.hi[s] = INT_MIN; 
   }
+  empty.thin = INT_MAX; 
+
+  int n, l, r; 
+  if (k >= leaves) {
+    leaves = std::max(64, 2 * leaves); 
+    tree.assign(2 * leaves, empty); 
+    l = leaves; 
+    r = leaves + k; 
+  } 
+  else 
+    l = r = leaves + k; 
+
+  for (n = l; n <= r; n++) { 
+    int j = n - leaves; 
+    for (int s = 0; s < 4; s++) 
+      tree[n].lo[s] = tree[n].hi[s] = bbox[s][j]; 
+    tree[n].thin = std::min(bbox[1][j] - bbox[0][j], bbox[3][j] - bbox[2][j]); 
+  }
+  for (l /= 2, r /= 2; r > 0; l /= 2, r /= 2) 
+    for (n = l; n <= r; n++) {
+      const node_t &a = tree[2*n], &b = tree[2*n + 1]; 
+      for (int s = 0; s < 4; s++) {
+        tree[n].lo[s] = std::min(a.lo[s], b.lo[s]); 
+        tree[n].hi[s] = std::max(a.hi[s], b.hi[s]); 
+      }
+      tree[n].thin = std::min(a.thin, b.thin); 
+    }
+} // grow()
+
+int Chunks::lastAway( int i, const Blob &region ) const 
+{
+  int k = std::lower_bound(index.begin(), index.end(), i) - index.begin(); 
+  if (k == 0) 
+    return -1; 
+  return _lastAway(1, 0, leaves, k, region); 
+} // lastAway()
+
+int Chunks::_lastAway( int n, int l, int r, int k, const Blob &region ) const 
+/* Blob::Intersects() is only nonzero for boxes that overlap by more than 
+ * an edge, and is whenever they do and neither is a line. Every box under
+ * a node overlaps region exactly when the extremes of each side do, so a
+ * node is passed over just when all of its boxes overlap region and none
+ * is a line. Only a node straddling row k, or one that has a track that 
+ * doesn't intersect, is gone into, so this is at most two paths down the 
+ * tree. (Looking for one that does intersect can't be bounded this way: 
+ * the extent of a node may overlap region when none of its boxes do.) */ 
+{
+  if (l >= k) 
+    return -1; 
+
+  const node_t &a = tree[n]; 
+  const int *R = region.bbox; 
+  if (a.thin > 0 && std::min(R[1] - R[0], R[3] - R[2]) > 0 && 
+      a.hi[0] < R[1] && a.lo[1] > R[0] && 
+      a.hi[2] < R[3] && a.lo[3] > R[2]) 
+    return -1; 
+
+  if (r - l == 1) 
+    return track(l).blob.Intersects(region) == 0 ? l : -1; 
+
+  int m = (l + r) / 2, j = _lastAway(2*n + 1, m, r, k, region); 
+  return j >= 0 ? j : _lastAway(2*n, l, m, k, region); 
+} // _lastAway()
+
+void Chunks::mergeWithNext( int c ) 
+{
+  merge(c, c + 1); 
 } // mergeWithNext()
  
 void Chunks::merge( int i, int j )
+/* The tracks of chunks i to j are already side by side, so only the 
+ * ranges are joined, and the rows of the others dropped in one go. */ 
 {
-  /* TODO Merge gaps into a chunk within range i to j */	
-}
+  j = std::min(j, (int)chunks.size() - 1); 
+  if (i < 0 || j <= i) 
+    return; 
+
+  known.erase(std::upper_bound(known.begin(), known.end(), chunks[i].start_index), 
+              std::upper_bound(known.begin(), known.end(), chunks[j].start_index)); 
+  for (int c = i + 1; c <= j; c++) 
+    chunks[i].most = std::max(chunks[i].most, chunks[c].most); 
+  chunks[i].end_index = chunks[j].end_index; 
+  chunks[i].last = chunks[j].last; 
+  chunks.erase(chunks.begin() + i + 1, chunks.begin() + j + 1); 
+} // merge()
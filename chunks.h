@@ -27,6 +27,7 @@
 #include <vector>
 #include <iostream>
 #include "blobs.h"
+#include "tracker.h"
 
 
 class TrackException {
@@ -74,7 +75,6 @@ friend std::ostream &operator<< (std::ostream &out, const Chunk &chunk);
 friend class Chunks; 
 public:
 
-  Chunk( Chunk *p );
   Chunk(); 
 
   /* Preceeding gap is known to NOT contain a target. */ 
@@ -87,20 +87,40 @@ public:
   void setStartIndex( int i );
   void setEndIndex( int i );
   
-  /* Routines for target tracking. */ 
+  /* Routines for target tracking. The delta frame may be given as the 
+   * blobs found in it. Every blob is followed by a Tracker; the chunk's 
+   * own track follows one target, and when there are more blobs than 
+   * the one-target rules below know what to do with, it goes where the 
+   * tracker takes that target. */ 
   void setStartPos( const cv::Mat &delta, int i );  
   void setStartPos( const cv::Mat&, const Blob &last_known_pos, int i ); 
   void updateTarget( const cv::Mat &delta, int i ); 
+  void setStartPos( const std::vector<Blob> &blobs, int i );  
+  void setStartPos( const std::vector<Blob> &blobs, 
+                    const Blob &last_known_pos, int i ); 
+  void updateTarget( const std::vector<Blob> &blobs, int i ); 
   const Blob &getStartPos() const; 
   const Blob &getEndPos() const; 
   const std::vector<Track>& getTracks() const; 
 
+  /* Where the target is expected in frame i, from the velocity the 
+   * tracker has for it. */ 
+  Blob predict( int i ) const; 
+
+  /* Most targets seen in more than one frame at once. */ 
+  int getMostTargets() const; 
+
 private: 
 
+  /* Note which of the tracker's targets the track follows. */ 
+  void retarget(); 
+
   bool gap_known;               /* preceeding gap known to NOT contain a target */ 
   int start_index, end_index;   /* time index of range of chunk */ 
   std::vector<Track> tracks;    /* (Blob, index) list */ 
-  Chunk *prev, *next;  
+  Tracker targets;              /* every target in the chunk */ 
+  int target;                   /* id of the one tracks follows */ 
+  int most;                     /* most targets at once */ 
 
 };
 
@@ -109,35 +129,93 @@ std::ostream&operator<< (std::ostream &out, const Chunk &chunk);
 
 
 /**
- * class Chunks - a double linked list that represents segments in a video
- * feed in which a target appears. 
+ * class Chunks - the segments of a video feed in which a target appears,
+ * in a table in frame order. A finished Chunk is appended to it, and its
+ * tracks are stored column by column (frame index, bounding box, 
+ * centroid, volume) after those of the chunks before it, so the tracks 
+ * of a chunk are a range of rows, and merging adjacent chunks only 
+ * joins their ranges. Chunks don't overlap, so the chunk of a frame is 
+ * found by binary search on their start, and a tree over the track rows
+ * keeping the extent of the bounding boxes under each node finds the 
+ * last track before a frame that intersects a region, or doesn't, 
+ * without looking at every track. 
  */ 
 
 class Chunks {
 public:
 
+  /* A row of the table. Its tracks are rows first to last - 1. */ 
+  struct chunk_t {
+    int start_index, end_index; /* time index range of chunk */ 
+    int first, last;            /* range of track rows */ 
+    bool gap_known;             /* preceeding gap known to NOT contain a target */ 
+    int most;                   /* most targets at once */ 
+  };
+
+  typedef std::vector<chunk_t>::const_iterator const_iterator; 
+
   Chunks(); 
-  ~Chunks();
   int size() const;
+  const_iterator begin() const; 
+  const_iterator end() const; 
+  const chunk_t &operator[]( int c ) const; 
+
+  /* Track at a row; there are tracks() of them. */ 
+  int tracks() const; 
+  Track track( int k ) const; 
+  Blob startPos( int c ) const; 
+  Blob endPos( int c ) const; 
+
+  /* Add a finished chunk after the last one. */ 
+  void append( const Chunk &chunk ); 
 
-  /* iterators, forward and backward */ 
-  Chunk *start(); 
-  Chunk *next();
-  Chunk *prev();  
-  Chunk *end(); 
-  Chunk *append( Chunk *gap ); 
-  Chunk *back();
+  /* Preceeding gap of chunk c is known to NOT contain a target. */ 
+  void gapKnown( int c, bool k ); 
+
+  /* Last chunk whose preceeding gap is known, or -1. */ 
+  int lastKnown() const; 
+
+  /* Chunk containing frame i, or the last one before it, or -1. */ 
+  int find( int i ) const; 
+
+  /* Row of the last track before frame i whose blob doesn't intersect 
+   * region, or -1 if there isn't one. */ 
+  int lastAway( int i, const Blob &region ) const; 
 
   /* Gap between chunks known to contain a target, merge them. */ 
-  void mergeWithNext( Chunk *chunk ); 
+  void mergeWithNext( int c ); 
 
-  /* Merge an entire range. */ 
-  void merge( int i, int j ); // TODO 
+  /* Merge an entire range: chunks i to j, and the gaps between them, 
+   * become chunk i. */ 
+  void merge( int i, int j ); 
 
 private:
+
+  /* Extent of the bounding boxes of the tracks under a node of the tree:
+   * least and greatest of each side, and the least width or height. */ 
+  struct node_t {
+    int lo [4], hi [4]; 
+    int thin; 
+  };
+
+  /* Set leaf k of the tree, and the nodes above it. */ 
+  void grow( int k ); 
+
+  /* lastAway() under node n, which covers rows l to r - 1, before row k. */
+  int _lastAway( int n, int l, int r, int k, const Blob &region ) const; 
   
-  Chunk *head, *curr, *tail;
-  int ct; 
+  std::vector<chunk_t> chunks; 
+  std::vector<int> known;       /* start of chunks whose gap is known */ 
+  int frame_width, frame_height; 
+
+  /* Track columns */ 
+  std::vector<int> index; 
+  std::vector<int> bbox [4]; 
+  std::vector<int> centroid_x, centroid_y; 
+  std::vector<int> volume; 
+
+  std::vector<node_t> tree;     /* leaves at the end, from row 0 */ 
+  int leaves; 
 
 }; 
 
@@ -0,0 +1,354 @@
+/* John Muir Institute for the Environment
+ * University of California, Davis
+ *
+ * compare.cpp
+ * Check the faster paths through the pipeline against the plain ones they
+ * stand in for, on random input. Each comparison prints what it tried and
+ * the number of disagreements. This file is part of the Salamander
+ * project.
+ *
+ * Copyright (C) 2013 Christopher Patton
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "salamander.h"
+#include "blobs.h"
+#include "mask.h"
+#include "runs.h"
+#include "workspace.h"
+#include "tracker.h"
+#include "files.h"
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+using namespace std;
+
+const char *help =
+" compare - check the faster paths of the pipeline against the plain ones.\n\
+Usage: compare <test> [trials] [seed]\n\
+\n\
+  labels     ConnectedComponents and MaskComponents on 1 to 16 threads\n\
+             against serial ConnectedComponents, on random frames large\n\
+             enough to be labeled in strips.\n\
+\n\
+  morph      BitMask (both engines) and RunMask erosion and dilation\n\
+             against cv::erode and cv::dilate, with random factors and\n\
+             both element shapes.\n\
+\n\
+  windows    Workspace::detect() with --cascade, --tiles and both\n\
+             against the whole frame, and in a random window, as with\n\
+             --roi, against the blobs of the whole frame.\n\
+\n\
+  swaps      Follow ten 8 px squares moving up to 24 px a frame with a\n\
+             Tracker for 20 frames, and count how often a square's id\n\
+             changes. Reported, not checked.\n\
+\n\
+Exits with a failure status if anything disagrees.\n";
+
+bool same( const Blob &a, const Blob &b )
+/* Same bounding box, centroid and volume. */
+{
+  for (int q = 0; q < 4; q++)
+    if (a[q] != b[q])
+      return false;
+  return a.GetCentroidX() == b.GetCentroidX() &&
+         a.GetCentroidY() == b.GetCentroidY() &&
+         a.GetVolume() == b.GetVolume();
+} // same()
+
+void randomFrame( cv::Mat &img, int rows, int cols )
+/* Salt noise of a random density, and a few squares of random size, so
+ * that there are components of every size, some crossing strips. */
+{
+  img.create(rows, cols, CV_8UC1);
+  img = cv::Scalar(0);
+  int density = rand() % 40;
+  for (int i = 0; i < rows; i++) {
+    uchar *p = img.ptr<uchar>(i);
+    for (int j = 0; j < cols; j++)
+      if (rand() % 100 < density)
+        p[j] = 255;
+  }
+  for (int n = rand() % 8; n > 0; n--) {
+    int i0 = rand() % rows, j0 = rand() % cols, s = 1 + rand() % 300;
+    cv::Rect r(j0, i0, min(s, cols - j0), min(s, rows - i0));
+    img(r) = cv::Scalar(255);
+  }
+} // randomFrame()
+
+int compareLabels( int trials )
+/* Frames of 0.5 to 3 megapixels; two strips are 512K pixels. */
+{
+  int bad = 0, tried = 0;
+  cv::Mat img;
+  BitMask mask;
+  ConnectedComponents serial, cc;
+  MaskComponents mc;
+
+  for (int t = 0; t < trials; t++) {
+    int rows = 480 + rand() % 1100, cols = 640 + rand() % 1400;
+    randomFrame(img, rows, cols);
+    mask.fromMat(img);
+    serial.label(img, 0, 1);
+
+    for (int threads = 1; threads <= 16; threads++) {
+      cc.label(img, 0, threads);
+      mc.label(mask, 0, threads);
+      bool ok = (cc.size() == serial.size() && mc.size() == serial.size());
+      for (int k = 0; ok && k < serial.size(); k++)
+        ok = same(cc[k], serial[k]) && same(mc[k], serial[k]);
+      if (!ok) {
+        bad++;
+        cout << "  " << rows << 'x' << cols << " on " << threads
+             << " threads: " << cc.size() << ' ' << mc.size()
+             << " blobs, serial " << serial.size() << endl;
+      }
+      tried++;
+    }
+  }
+  cout << "labels: " << tried << " labelings, " << bad << " differ\n";
+  return bad;
+} // compareLabels()
+
+int compareMorphology( int trials )
+/* Sparse and dense masks, from one row or column up to a shrunk frame,
+ * with factors up to beyond their size. */
+{
+  int bad = 0, tried = 0;
+  cv::Mat img, ref, out;
+  BitMask mask;
+  RunMask runs;
+  param_t options;
+
+  for (int t = 0; t < trials * 100; t++) {
+    int rows = 1 + rand() % 240, cols = 1 + rand() % 360;
+    randomFrame(img, rows, cols);
+    options.erode = rand() % 8;
+    options.dilate = rand() % 40;
+    options.shape = (rand() % 2) ? SHAPE_RECT : SHAPE_ELLIPSE;
+
+    img.copyTo(ref);
+    morphology(ref, options);
+
+    for (int engine = ENGINE_LINEAR; engine <= ENGINE_RUNS; engine++) {
+      options.engine = engine;
+      mask.fromMat(img);
+      if (engine == ENGINE_RUNS) {
+        runs.fromBits(mask);
+        morphology(runs, options);
+        runs.toMat(out);
+      }
+      else {
+        morphology(mask, options);
+        mask.toMat(out);
+      }
+      bool ok = (out.size() == ref.size());
+      for (int i = 0; ok && i < rows; i++)
+        ok = (memcmp(out.ptr<uchar>(i), ref.ptr<uchar>(i), cols) == 0);
+      if (!ok) {
+        bad++;
+        cout << "  " << rows << 'x' << cols << " -m " << options.erode
+             << ' ' << options.dilate << " shape " << options.shape
+             << " engine " << engine << endl;
+      }
+      tried++;
+    }
+  }
+  cout << "morph: " << tried << " masks, " << bad << " differ\n";
+  return bad;
+} // compareMorphology()
+
+void randomPair( cv::Mat &A, cv::Mat &B, int rows, int cols )
+/* A still background, and the same with sensor noise and a few patchy
+ * targets in front of it. */
+{
+  A.create(rows, cols, CV_8UC1);
+  B.create(rows, cols, CV_8UC1);
+  A = cv::Scalar(100);
+  for (int i = 0; i < rows; i++) {
+    uchar *p = B.ptr<uchar>(i);
+    for (int j = 0; j < cols; j++)
+      p[j] = 100 + rand() % 5;
+  }
+  for (int n = rand() % 4; n > 0; n--) {
+    int i0 = rand() % rows, j0 = rand() % cols, v = 130 + rand() % 40;
+    int h = 1 + rand() % 30, w = 1 + rand() % 30;
+    for (int i = i0; i < min(rows, i0 + h); i++)
+      for (int j = j0; j < min(cols, j0 + w); j++)
+        if (rand() % 6)
+          B.ptr<uchar>(i)[j] = v;
+  }
+} // randomPair()
+
+bool same( const Workspace &a, const Workspace &b )
+/* Same blobs, in the same order. */
+{
+  if (a.blobs.size() != b.blobs.size())
+    return false;
+  for (int k = 0; k < a.blobs.size(); k++)
+    if (!same(a.blobs[k], b.blobs[k]))
+      return false;
+  return true;
+} // same()
+
+int compareWindows( int trials )
+/* The shortcuts must find exactly the blobs of the whole frame. A window
+ * may only be trusted when detect() doesn't give up on it, and then each
+ * of its blobs must be one of the whole frame's. */
+{
+  int bad = 0, tried = 0, windows = 0;
+  cv::Mat A, B;
+  Workspace full, ws;
+  param_t options;
+  options.threads = 1;
+  options.roi = 0;
+
+  for (int t = 0; t < trials * 100; t++) {
+    int rows = 1 + rand() % 240, cols = 1 + rand() % 360;
+    randomPair(A, B, rows, cols);
+    options.erode = rand() % 5;
+    options.dilate = rand() % 8;
+    options.shape = (rand() % 2) ? SHAPE_RECT : SHAPE_ELLIPSE;
+    options.engine = rand() % 3;
+    options.low = 20 + rand() % 30;
+    options.high = 60 + rand() % 100;
+    options.min_volume = rand() % 3;
+
+    options.cascade = options.tiles = false;
+    full.detect(A, B, options);
+
+    for (int k = 1; k < 4; k++) {
+      options.cascade = (k & 1);
+      options.tiles = (k & 2);
+      ws.detect(A, B, options);
+      if (!same(ws, full)) {
+        bad++;
+        cout << "  " << rows << 'x' << cols << " -m " << options.erode
+             << ' ' << options.dilate << (options.cascade ? " --cascade" : "")
+             << (options.tiles ? " --tiles" : "") << ": "
+             << ws.blobs.size() << " blobs, whole frame "
+             << full.blobs.size() << endl;
+      }
+      tried++;
+    }
+
+    cv::Rect window(rand() % cols, rand() % rows, 0, 0);
+    window.width = 1 + rand() % (cols - window.x);
+    window.height = 1 + rand() % (rows - window.y);
+    options.cascade = options.tiles = false;
+    if (ws.detect(A, B, window, options) < 0)
+      continue;
+    bool ok = true;
+    for (int k = 0; ok && k < ws.blobs.size(); k++) {
+      ok = false;
+      for (int m = 0; !ok && m < full.blobs.size(); m++)
+        ok = same(ws.blobs[k], full.blobs[m]);
+    }
+    if (!ok) {
+      bad++;
+      cout << "  " << rows << 'x' << cols << " window " << window.x << ','
+           << window.y << ' ' << window.width << 'x' << window.height
+           << ": a blob the whole frame doesn't have\n";
+    }
+    windows++;
+  }
+  cout << "windows: " << tried << " frames and " << windows
+       << " windows, " << bad << " differ\n";
+  return bad;
+} // compareWindows()
+
+int countSwaps( int trials )
+/* Each blob is matched to the nearest square to see which it is. */
+{
+  const int N = 10, frames = 20, side = 8, size = 1000;
+  int swaps = 0;
+  cv::Mat img;
+  vector<Blob> blobs;
+
+  for (int t = 0; t < trials; t++) {
+    vector<int> pi(N), pj(N), vi(N), vj(N), id(N, -1);
+    for (int k = 0; k < N; k++) {
+      pi[k] = 300 + (k / 5) * 300;
+      pj[k] = 100 + (k % 5) * 180;
+      vi[k] = rand() % 49 - 24;
+      vj[k] = rand() % 49 - 24;
+      if (vi[k] == 0)
+        vi[k] = 9;
+    }
+
+    Tracker tracker;
+    for (int f = 0; f < frames; f++) {
+      img.create(size, size, CV_8UC1);
+      img = cv::Scalar(0);
+      for (int k = 0; k < N; k++) {
+        cv::Rect r = cv::Rect(pj[k], pi[k], side, side) &
+                     cv::Rect(0, 0, size, size);
+        if (r.area() > 0)
+          img(r) = cv::Scalar(255);
+      }
+      getBlobs(img, blobs);
+      tracker.update(blobs, f);
+
+      for (int b = 0; b < blobs.size(); b++) {
+        int best = 0;
+        long long dist = -1;
+        for (int k = 0; k < N; k++) {
+          long long di = blobs[b].GetCentroidX() - (pi[k] + side / 2 - 1),
+                    dj = blobs[b].GetCentroidY() - (pj[k] + side / 2 - 1);
+          if (dist < 0 || di * di + dj * dj < dist) {
+            dist = di * di + dj * dj;
+            best = k;
+          }
+        }
+        int owner = tracker[tracker.owner(b)].id;
+        if (id[best] >= 0 && id[best] != owner)
+          swaps++;
+        id[best] = owner;
+      }
+
+      for (int k = 0; k < N; k++) {
+        pi[k] += vi[k];
+        pj[k] += vj[k];
+      }
+    }
+  }
+  cout << "swaps: " << trials << " runs of " << N << " targets, " << swaps
+       << " id swaps\n";
+  return 0;
+} // countSwaps()
+
+
+int main(int argc, const char **argv)
+{
+  if (argc < 2)
+    die(help);
+
+  int trials = (argc > 2) ? atoi(argv[2]) : 10;
+  srand((argc > 3) ? atoi(argv[3]) : 1);
+
+  int bad = 0;
+  if (strcmp(argv[1], "labels") == 0)
+    bad = compareLabels(trials);
+  else if (strcmp(argv[1], "morph") == 0)
+    bad = compareMorphology(trials);
+  else if (strcmp(argv[1], "windows") == 0)
+    bad = compareWindows(trials);
+  else if (strcmp(argv[1], "swaps") == 0)
+    bad = countSwaps(trials);
+  else
+    die(help);
+
+  return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -49,7 +49,16 @@ order. Eg. ls *.jpg | detect <options>\n\
   -t L H     Binary threshold range <L, H>. 0 < L < H < 255.\n\n\
   -m E D     Binary morphology erode and dilate factors. Eg., 2 20.\n\
              Threshold range defaults to <40, 60> if -t is unspecified.\n\n\
+  --shape S  Structuring element, ellipse (default) or rect.\n\n\
+  --morph M  Morphology implementation: linear (default), whose cost\n\
+             doesn't grow with the factors; shift, which is faster\n\
+             for small ones; or runs, whose cost grows with the\n\
+             foreground, for mostly empty masks.\n\n\
   -s N       Image shrink factor. Defaults to 1 (don't shrink)\n\n\
+  -x file    Index of JPEG images. If it exists, it's read instead of\n\
+             standard input; otherwise it's saved for the next run.\n\n\
+  -j N       Threads for checking the file names, 0 to check them on\n\
+             the main thread. Defaults to the number of processors.\n\n\
   -f name    File prefix for output files.\n\n\
   -h         Display this message.";
 
@@ -68,9 +77,16 @@ int main(int argc, const char **argv)
   if (options.erode < 0) 
     die("error: must specify binary morphology factors");
 
+  if (options.follow[0] != '\0' || options.input[0] != '\0') 
+    die("error: detect only reads a list of JPEG images"); 
+
   /* get file names */
   std::vector<std::string> names; 
-  filenames( names, std::cin );
+  if (options.index[0] == '\0' || !loadIndex( names, options.index )) {
+    filenames( names, std::cin, options.threads ); 
+    if (options.index[0] != '\0') 
+      saveIndex( names, options.index ); 
+  }
 
   /* TODO - the actual work. */ 
 
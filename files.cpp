@@ -27,11 +27,14 @@
 #include <algorithm> //sort()
 #include <string> 
 #include <iostream>
+#include <fstream>
 #include <stdio.h>
 #include <string.h> 
 #include <errno.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include <cmath>
+#include <pthread.h>
 
 #define NUMERIC(x) (x >= '0') && (x <= '9') 
 #define ALPHABETIC(x) ((x >= 'a') && (x <= 'z')) || ((x >= 'A') && (x <= 'Z'))
@@ -42,75 +45,163 @@ void die( const char *msg )
    exit(EXIT_FAILURE); 
 } // die() 
 
+const char *baseName( const char *path ) 
+{
+  const char *p = strrchr(path, '/'); 
+  return p ? p + 1 : path; 
+} // baseName()
+
 bool empty( const char *file ) 
 {
-  static struct stat st;
-  stat(file, &st);
-  switch( errno ) {
-    case ENOENT:
+  struct stat st;
+  if (stat(file, &st) != 0) {
+    if (errno == ENOENT) 
       std::cerr << "can't stat " << file << ": file not found\n" << std::endl;
-      return true;
+    else 
+      std::cerr << "can't stat " << file << ": " << strerror(errno) << std::endl;
+    return true;
   }
   return (st.st_size <= 0);
 } // empty() 
 
-void filenames( std::vector<std::string> &names, std::istream &in ) 
+
+/* A slice of the names for one stat worker. */ 
+struct stat_job_t {
+  const std::vector<std::string> *names; 
+  std::vector<char> *keep; 
+  int begin, end; 
+}; 
+
+static void *statNames( void *arg ) 
+/* Mark the names in a slice that aren't empty. */
+{
+  stat_job_t *job = (stat_job_t *)arg; 
+  for (int i = job->begin; i < job->end; i++) 
+    (*job->keep)[i] = !empty( (*job->names)[i].c_str() ); 
+  return NULL; 
+} // statNames()
+
+void filenames( std::vector<std::string> &names, std::istream &in, int threads ) 
 /* Get filenames from standard input and filter out corrupted ones. So far, 
  * these are images that are empty (0 bytes). Sort files in alphanumeric 
- * order. */
+ * order. The list ends at EOF or a blank line. Files are stat'ed by a pool 
+ * of threads, since on a network mount each one is a round trip. */
 {
-  char name [128]; 
-  in.getline(name, 128);
-  while( name[0] != '\0' ) 
-  {
-    if( !empty(name) )
-      names.push_back( std::string(name) ); 
-    in.getline(name, 128);
+  std::vector<std::string> all; 
+  std::string name; 
+  while( std::getline(in, name) && !name.empty() ) 
+    all.push_back( name ); 
+
+  int n = all.size(); 
+  if (threads > n / 64) /* not worth a thread for a few files */ 
+    threads = n / 64; 
+  if (threads < 1) 
+    threads = 1; 
+
+  std::vector<char> keep(n); 
+  std::vector<stat_job_t> jobs(threads); 
+  std::vector<pthread_t> workers(threads); 
+  for (int t = 0; t < threads; t++) {
+    jobs[t].names = &all; 
+    jobs[t].keep = &keep; 
+    jobs[t].begin = (long)n * t / threads; 
+    jobs[t].end = (long)n * (t+1) / threads; 
   }
-  sort(names.begin(), names.end(), cmp);
+  for (int t = 1; t < threads; t++) 
+    pthread_create(&workers[t], NULL, statNames, &jobs[t]); 
+  statNames(&jobs[0]); 
+  for (int t = 1; t < threads; t++) 
+    pthread_join(workers[t], NULL); 
+
+  for (int i = 0; i < n; i++) 
+    if (keep[i]) 
+      names.push_back( all[i] ); 
+  sortNames( names ); 
 } // filenames()
 
 
+std::string sortKey( const std::string &name ) 
+/* Each run of digits is stripped of leading zeros and left padded with 
+ * zeros to KEY_DIGITS, so that comparing keys character by character 
+ * compares the numbers by value. Longer runs are kept as they are. */ 
+{
+  std::string key; 
+  key.reserve(name.size() + KEY_DIGITS); 
+  unsigned i = 0, m; 
+  while (i < name.size()) {
+    if (NUMERIC(name[i])) {
+      while (i + 1 < name.size() && name[i] == '0' && NUMERIC(name[i+1])) 
+        i++; 
+      for (m = i; m < name.size() && NUMERIC(name[m]); m++) 
+        ; 
+      if (m - i < KEY_DIGITS) 
+        key.append(KEY_DIGITS - (m - i), '0'); 
+      key.append(name, i, m - i); 
+      i = m; 
+    }
+    else 
+      key += name[i++]; 
+  }
+  return key; 
+} // sortKey()
+
+void sortNames( std::vector<std::string> &names ) 
+/* Sort on keys computed once per name, rather than once per comparison. 
+ * Names with equal keys (e.g. "a01" and "a1") are ordered as strings. */ 
+{
+  std::vector<std::pair<std::string, std::string> > keyed(names.size()); 
+  for (int i = 0; i < names.size(); i++) {
+    keyed[i].first = sortKey(names[i]); 
+    keyed[i].second.swap(names[i]); 
+  }
+  sort(keyed.begin(), keyed.end()); 
+  for (int i = 0; i < names.size(); i++) 
+    names[i].swap(keyed[i].second); 
+} // sortNames()
+
 bool cmp(const std::string &a, const std::string &b) 
 /* compare function for sorting filenames Compare alphabetically and 
  * numerically. Use this way: for files of type vector<string>, 
- * sort(files.begin(), files.end(), cmp). */
+ * sort(files.begin(), files.end(), cmp). Prefer sortNames() for long 
+ * lists. */
 {
-  unsigned i=0, j=0, m, n, an, bn; 
-  while( i < a.size() && j < b.size() ) {
-
-    if (NUMERIC(a[i]) && NUMERIC(b[j])) {
-
-      m = i;
-      while( m < a.size() && NUMERIC(a[m]) )
-        m++; 
-
-      n = j; 
-      while( n < b.size() && NUMERIC(a[n]) )
-        n++;
-
-      an = atoi( a.substr(i,m).c_str() ); 
-      bn = atoi( b.substr(j,n).c_str() );
+  std::string ak = sortKey(a), bk = sortKey(b); 
+  if (ak != bk) 
+    return ak < bk; 
+  return a < b; 
+} // cmp()
 
-      if (an < bn) return true; 
-      else if (an > bn) return false;
 
-      i = m; 
-      j = n; 
+#define INDEX_MAGIC "# salamander index 1"
 
-    }
-
-    if (a[i] < b[j])
-      return true;
-    else if (a[i] > b[j]) 
-      return false; 
+bool loadIndex( std::vector<std::string> &names, const char *fn ) 
+/* The index is a magic line followed by one name per line, in order. */ 
+{
+  std::ifstream in(fn); 
+  std::string line; 
+  if (!in || !std::getline(in, line) || line != INDEX_MAGIC) 
+    return false; 
+  names.clear(); 
+  while (std::getline(in, line)) 
+    names.push_back(line); 
+  return true; 
+} // loadIndex()
 
-    i++; 
-    j++;
+void saveIndex( const std::vector<std::string> &names, const char *fn ) 
+/* Write to a temporary file and rename it, so that an interrupted run 
+ * doesn't leave a truncated index behind. */ 
+{
+  std::string tmp = std::string(fn) + ".tmp"; 
+  std::ofstream out(tmp.c_str()); 
+  out << INDEX_MAGIC << '\n'; 
+  for (int i = 0; i < names.size(); i++) 
+    out << names[i] << '\n'; 
+  out.close(); 
+  if (!out || rename(tmp.c_str(), fn) != 0) {
+    std::cerr << "can't write index " << fn << std::endl; 
+    unlink(tmp.c_str()); 
   }
-
-  return a.size() < b.size();
-} // cmp()
+} // saveIndex()
 
 void sample(std::vector<int> &samples, int ct, int i, int j, int mean, int sd) 
 /* Box-Muller method for approximating a normal distribution. Generate normally 
@@ -156,12 +247,30 @@ void sample(std::vector<int> &samples, int ct, int i, int j, int mean, int sd)
 
 
 
+int processors() 
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN); 
+  return (n < 1 ? 1 : (int)n); 
+} // processors() 
+
+
 int parse_options( param_t &options, int argc, const char **argv ) 
 /* Parse command line options and return a status, informing the up stream 
  * if the parameters weren't inputted correctly. */ 
 {
   options.shrink_factor = options.low = options.high = options.erode = options.dilate = -1; 
+  options.threads = -1; 
+  options.backlog = -1; 
+  options.min_volume = 0; 
+  options.cascade = false; 
+  options.roi = 0; 
+  options.tiles = false; 
+  options.shape = SHAPE_ELLIPSE; 
+  options.engine = ENGINE_LINEAR; 
   options.prefix[0] = '\0';
+  options.input[0] = '\0';
+  options.follow[0] = '\0';
+  options.index[0] = '\0';
 
   for (int i = 1; i < argc; i++) 
   {
@@ -190,6 +299,45 @@ int parse_options( param_t &options, int argc, const char **argv )
       }
     }
     
+    /* structuring element */ 
+    else if (strcmp(argv[i], "--shape") == 0 && (argc - i) > 1) { 
+      i++; 
+      if (strcmp(argv[i], "ellipse") == 0) 
+        options.shape = SHAPE_ELLIPSE; 
+      else if (strcmp(argv[i], "rect") == 0) 
+        options.shape = SHAPE_RECT; 
+      else 
+        return 0; 
+    }
+
+    /* morphology engine */ 
+    else if (strcmp(argv[i], "--morph") == 0 && (argc - i) > 1) { 
+      i++; 
+      if (strcmp(argv[i], "linear") == 0) 
+        options.engine = ENGINE_LINEAR; 
+      else if (strcmp(argv[i], "shift") == 0) 
+        options.engine = ENGINE_SHIFT; 
+      else if (strcmp(argv[i], "runs") == 0) 
+        options.engine = ENGINE_RUNS; 
+      else 
+        return 0; 
+    }
+
+    /* coarse-to-fine detection */ 
+    else if (strcmp(argv[i], "--cascade") == 0) 
+      options.cascade = true; 
+
+    /* change map */ 
+    else if (strcmp(argv[i], "--tiles") == 0) 
+      options.tiles = true; 
+
+    /* tracking window */ 
+    else if (strcmp(argv[i], "--roi") == 0 && (argc - i) > 1) { 
+      if (!NUMERIC(argv[i+1][0])) 
+        return 0; 
+      options.roi = atoi(argv[++i]);
+    }
+
     /* output file prefix */ 
     else if (strcmp(argv[i], "-f") == 0 && (argc - i) > 1) { 
       i++; 
@@ -206,6 +354,48 @@ int parse_options( param_t &options, int argc, const char **argv )
       if (options.shrink_factor < 1)
         return 0; 
     }
+
+    /* video file */ 
+    else if (strcmp(argv[i], "-i") == 0 && (argc - i) > 1) { 
+      if (strlen(argv[++i]) >= sizeof(options.input))
+        return 0; 
+      strcpy(options.input, argv[i]); 
+    }
+
+    /* live camera directory */ 
+    else if (strcmp(argv[i], "--follow") == 0 && (argc - i) > 1) { 
+      if (strlen(argv[++i]) >= sizeof(options.follow))
+        return 0; 
+      strcpy(options.follow, argv[i]); 
+    }
+
+    /* file name index */ 
+    else if (strcmp(argv[i], "-x") == 0 && (argc - i) > 1) { 
+      if (strlen(argv[++i]) >= sizeof(options.index))
+        return 0; 
+      strcpy(options.index, argv[i]); 
+    }
+
+    /* decoding threads */ 
+    else if (strcmp(argv[i], "-j") == 0 && (argc - i) > 1) { 
+      if (!NUMERIC(argv[i+1][0])) 
+        return 0; 
+      options.threads = atoi(argv[++i]);
+    }
+
+    /* output queue */ 
+    else if (strcmp(argv[i], "-w") == 0 && (argc - i) > 1) { 
+      if (!NUMERIC(argv[i+1][0])) 
+        return 0; 
+      options.backlog = atoi(argv[++i]);
+    }
+
+    /* smallest blob */ 
+    else if (strcmp(argv[i], "-v") == 0 && (argc - i) > 1) { 
+      if (!NUMERIC(argv[i+1][0])) 
+        return 0; 
+      options.min_volume = atoi(argv[++i]);
+    }
     else 
       return 0; 
     
@@ -214,6 +404,12 @@ int parse_options( param_t &options, int argc, const char **argv )
   if (options.shrink_factor < 0) 
     options.shrink_factor = 1; 
 
+  if (options.threads < 0) 
+    options.threads = processors(); 
+
+  if (options.backlog < 0) 
+    options.backlog = 64; 
+
   if (options.prefix[0] == '\0')
     strcpy(options.prefix, "test"); 
 
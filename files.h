@@ -34,20 +34,66 @@ void die( const char *msg );
 bool empty( const char *file );
 
 /**
- * Get filenames from standard input
+ * Last component of a path. Output files are named after the frames they 
+ * come from, in the working directory. 
  */
-void filenames( std::vector<std::string> &names, std::istream &in );
+const char *baseName( const char *path );
+
+/**
+ * Get filenames from standard input, checking them on up to threads 
+ * threads. 
+ */
+void filenames( std::vector<std::string> &names, std::istream &in, 
+                int threads=1 );
+
+/**
+ * Sort key of a file name. Keys compare as strings the way names compare 
+ * alphanumerically. 
+ */
+#define KEY_DIGITS 20
+std::string sortKey( const std::string &name ); 
+
+/**
+ * Sort file names alphanumerically. 
+ */
+void sortNames( std::vector<std::string> &names ); 
 
 /**
  * Sort function for files
  */ 
 bool cmp(const std::string &a, const std::string &b); 
 
+/**
+ * Read a list of file names saved by saveIndex(). Return false if there 
+ * isn't one. 
+ */
+bool loadIndex( std::vector<std::string> &names, const char *fn ); 
+
+/**
+ * Save a sorted, checked list of file names, so that the next run can 
+ * skip filenames(). 
+ */
+void saveIndex( const std::vector<std::string> &names, const char *fn ); 
+
 /** 
  * Generate normally distributed samples over a range of indices.
  */ 
 void sample(std::vector<int> &samples, int ct, int i, int j, int mean, int sd); 
 
+/**
+ * Number of processors online. This is system dependent. 
+ */
+int processors(); 
+
+
+/**
+ * Structuring elements and implementations of binary morphology 
+ */
+#define SHAPE_ELLIPSE 0
+#define SHAPE_RECT    1
+#define ENGINE_LINEAR 0  // cost independent of element size 
+#define ENGINE_SHIFT  1  // word shifts, one per row of the element 
+#define ENGINE_RUNS   2  // masks as runs; cost scales with the foreground 
 
 /** 
  * Command line options 
@@ -55,9 +101,20 @@ void sample(std::vector<int> &samples, int ct, int i, int j, int mean, int sd);
 struct param_t { 
   
   int erode, dilate; // bianry morphology factors
+  int shape;         // structuring element
+  int engine;        // morphology implementation
   int low,     high; // binary threshold range
   int shrink_factor; // shrink image for efficiency
+  int threads;       // frame decoding threads
+  int backlog;       // annotated frames queued for output
+  int min_volume;    // smallest blob, in pixels of the shrunk frame
+  bool cascade;      // sample the delta before thresholding all of it
+  int roi;           // track in a window, sweeping the frame every roi
+  bool tiles;        // only process the tiles of the delta that changed
   char prefix [256]; 
+  char input [256];  // video file, instead of JPEG files on stdin
+  char follow [256]; // directory to watch for new JPEG files
+  char index [256];  // saved list of JPEG files
 
 }; 
 
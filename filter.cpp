@@ -26,8 +26,11 @@
 #include "salamander.h"
 #include "blobs.h"
 #include "files.h"
+#include "frames.h"
+#include "workspace.h"
 #include <cstdio> //sprintf()
 #include <iostream>
+#include <csignal>
 using namespace std;
 
 const char *help = 
@@ -40,7 +43,28 @@ order, e.g., ls *.jpg | detect <options>\n\
   -t L H     Binary threshold range <L, H>. 0 < L < H < 255.\n\n\
   -m E D     Binary morphology erode and dilate factors. Eg., 2 20.\n\
              Threshold range defaults to <40, 60> if -t is unspecified.\n\n\
+  --shape S  Structuring element, ellipse (default) or rect.\n\n\
+  --morph M  Morphology implementation: linear (default), whose cost\n\
+             doesn't grow with the factors; shift, which is faster\n\
+             for small ones; or runs, whose cost grows with the\n\
+             foreground, for mostly empty masks.\n\n\
+  --cascade  Sample the delta on a coarse grid first, and only threshold\n\
+             all of it if the sample could hold a blob. Finds the same\n\
+             blobs, faster on idle footage with an erode factor of 2\n\
+             or more.\n\n\
+  --tiles    Only threshold, clean up and label the part of the delta\n\
+             around 32x32 tiles that changed. Finds the same blobs.\n\n\
   -s N       Image shrink factor. Defaults to 1 (don't shrink)\n\n\
+  -i file    Read frames from a video file (AVI, MJPEG, MP4, ...)\n\
+             instead of a list of JPEG images.\n\n\
+  -x file    Index of JPEG images. If it exists, it's read instead of\n\
+             standard input; otherwise it's saved for the next run.\n\n\
+  --follow dir  Process JPEG images as they are dropped in a directory,\n\
+             until interrupted.\n\n\
+  -j N       Frame decoding threads, 0 to decode on the main thread.\n\
+             Defaults to the number of processors.\n\n\
+  -v N       Ignore blobs of fewer than N pixels (after shrinking).\n\
+             Defaults to 0.\n\n\
   -f name    File prefix for output files.\n\n\
   -h         Display this message.";
 
@@ -56,26 +80,34 @@ int main(int argc, const char **argv)
     if (options.erode < 0) 
       die("error: must specify binary morphology factors");
 
-    /* get file names */
+    /* get file names, or open video */
     std::vector<std::string> names; 
-    filenames( names, std::cin );
+    FrameSource *source = openFrames( names, options, std::cin ); 
 
-    cv::Mat im;
-    std::vector<Blob> blobs; 
+    /* a live feed ends when we're told to stop */ 
+    if (options.follow[0] != '\0') {
+      signal( SIGINT, DirectoryFrameSource::interrupt ); 
+      signal( SIGTERM, DirectoryFrameSource::interrupt ); 
+    }
+
+    FrameBuffer frames( *source, 2, options.threads ); 
+
+    Workspace ws; 
+    const std::vector<Blob> &blobs = ws.blobs; 
 
-    char outname[256]; 
+    char outname[1024]; 
     int outindex = 0; 
 
     try 
     {
-        for( i = 1; i < names.size(); i ++ ) {
-            cout << names[i-1] << ' ' << names[i] << endl;
-            delta(im, names[i].c_str(), names[i-1].c_str(), true, options );
-            morphology( im, options );
-            getBlobs( im, blobs ); 
+        for( i = 1; frames.wait(i); i ++ ) {
+            cout << frames.name(i-1) << ' ' << frames.name(i) << endl;
+            ws.detect( frames[i], frames[i-1], options );
 
-            sprintf(outname, "%s-%s-%s.jpg", options.prefix, names[i-1].c_str(), names[i].c_str()); 
-            cv::imwrite( outname, im ); 
+            snprintf(outname, sizeof(outname), "%s-%s-%s.jpg", options.prefix, 
+                     baseName(frames.name(i-1)), baseName(frames.name(i))); 
+            if (!cv::imwrite( outname, ws.image() )) 
+              cerr << "can't write " << outname << endl; 
 
             for( j = 0; j < blobs.size(); j++) {
               cout << "     " << blobs[j] << endl; 
@@ -0,0 +1,718 @@
+/* John Muir Institute for the Environment
+ * University of California, Davis
+ *
+ * frames.cpp
+ * Sources of video frames for the image processing pipeline. This file
+ * is part of the Salamander project.
+ *
+ * Copyright (C) 2013 Christopher Patton
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "frames.h"
+#include <cstdio>
+#include <cstring>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <strings.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm> // sort()
+
+#define SETTLE_TIME 2   /* seconds a deferred file's size must stay put */
+
+/**
+ * class FrameSource
+ */
+
+FrameSource::~FrameSource()
+{
+} // destr
+
+bool FrameSource::wait( int i )
+{
+  return i < size();
+} // wait()
+
+bool FrameSource::sequential() const
+{
+  return false;
+} // sequential()
+
+
+/**
+ * class FileFrameSource
+ */
+
+FileFrameSource::FileFrameSource( const std::vector<std::string> &n,
+                                  const param_t &o )
+  : names(n), options(o)
+{
+} // constr
+
+int FileFrameSource::size() const
+{
+  return names.size();
+} // size()
+
+const char *FileFrameSource::name( int i ) const
+{
+  return names[i].c_str();
+} // name()
+
+void FileFrameSource::read( cv::Mat &img, int i )
+{
+  ::read(img, names[i].c_str(), options);
+} // read()
+
+void FileFrameSource::original( cv::Mat &img, int i )
+{
+  img = cv::imread(names[i].c_str()); 
+} // original()
+
+
+/**
+ * class VideoFrameSource
+ */
+
+VideoFrameSource::VideoFrameSource( const char *fn, const param_t &o ) 
+  : options(o)
+{
+  char name [512]; 
+  int i, ct; 
+  
+  if (!capture.open(fn)) {
+    sprintf(name, "error: can't open video %s", fn); 
+    die(name); 
+  }
+
+  /* Containers don't always know their length. If not, count the frames 
+   * by demuxing without decoding them. */ 
+  ct = (int)capture.get(CV_CAP_PROP_FRAME_COUNT); 
+  if (ct <= 0) {
+    for (ct = 0; capture.grab(); ct++)
+      ;
+    capture.set(CV_CAP_PROP_POS_FRAMES, 0); 
+  }
+  pos = 0; 
+
+  for (i = 0; i < ct; i++) {
+    sprintf(name, "%s-%06d.jpg", fn, i); 
+    names.push_back(std::string(name)); 
+  }
+
+  pthread_mutex_init(&lock, NULL); 
+} // constr
+
+VideoFrameSource::~VideoFrameSource() 
+{
+  pthread_mutex_destroy(&lock); 
+} // destr
+
+int VideoFrameSource::size() const
+{
+  return names.size();
+} // size()
+
+const char *VideoFrameSource::name( int i ) const
+{
+  return names[i].c_str();
+} // name()
+
+bool VideoFrameSource::decode( int i ) 
+/* Seek only if frame i isn't next in the container. */ 
+{
+  if (i != pos) 
+    capture.set(CV_CAP_PROP_POS_FRAMES, i); 
+  pos = i + 1; 
+  return capture.read(frame); 
+} // decode()
+
+void VideoFrameSource::read( cv::Mat &img, int i )
+/* The capture is shared, so decode one frame at a time. */ 
+{
+  pthread_mutex_lock(&lock); 
+  bool ok = decode(i); 
+  if (ok) 
+    prepare(img, frame, options); 
+  pthread_mutex_unlock(&lock); 
+  
+  if (!ok) 
+    CV_Error(CV_StsError, "can't decode frame " + names[i]); 
+} // read()
+
+void VideoFrameSource::original( cv::Mat &img, int i )
+{
+  pthread_mutex_lock(&lock); 
+  bool ok = decode(i); 
+  if (ok) 
+    frame.copyTo(img); 
+  pthread_mutex_unlock(&lock); 
+
+  if (!ok) 
+    CV_Error(CV_StsError, "can't decode frame " + names[i]); 
+} // original()
+
+bool VideoFrameSource::sequential() const
+{
+  return true;
+} // sequential()
+
+
+/**
+ * class DirectoryFrameSource
+ */
+
+volatile sig_atomic_t DirectoryFrameSource::interrupted = 0; 
+
+DirectoryFrameSource::DirectoryFrameSource( const char *d, const param_t &o ) 
+  : dir(d), options(o)
+/* Start watching before scanning the directory, so that no file can slip
+ * in between. A file that shows up in both is only taken once. A file 
+ * that may still be being written is deferred. */ 
+{
+  closed = false; 
+  pthread_mutex_init(&lock, NULL); 
+
+  fd = inotify_init(); 
+  if (fd < 0 || inotify_add_watch(fd, d, IN_CLOSE_WRITE | IN_MOVED_TO | 
+                                         IN_DELETE_SELF | IN_MOVE_SELF) < 0) 
+    die("error: can't watch directory"); 
+
+  std::vector<std::string> existing; 
+  DIR *dp = opendir(d); 
+  if (!dp) 
+    die("error: can't read directory"); 
+  struct dirent *ent; 
+  while ((ent = readdir(dp)) != NULL) 
+    existing.push_back(dir + "/" + ent->d_name); 
+  closedir(dp); 
+
+  sortNames(existing); 
+  for (int i = 0; i < existing.size(); i++) {
+    const char *file = existing[i].c_str(); 
+    if (!isJPEG(file)) 
+      continue; 
+    if (complete(file)) 
+      add(file); 
+    else {
+      deferred_t d = { existing[i], -1, time(NULL) }; 
+      deferred.push_back(d); 
+    }
+  }
+} // constr
+
+DirectoryFrameSource::~DirectoryFrameSource() 
+{
+  close(fd); 
+  pthread_mutex_destroy(&lock); 
+} // destr
+
+void DirectoryFrameSource::interrupt( int sig ) 
+{
+  interrupted = 1; 
+} // interrupt()
+
+void DirectoryFrameSource::add( const char *file ) 
+{
+  if (!isJPEG(file) || listed.count(file) > 0 || empty(file)) 
+    return; 
+  listed.insert(file); 
+
+  pthread_mutex_lock(&lock); 
+  names.push_back(std::string(file)); 
+  pthread_mutex_unlock(&lock); 
+} // add()
+
+bool DirectoryFrameSource::isJPEG( const char *file ) 
+{
+  const char *ext = strrchr(file, '.'); 
+  return ext && (strcasecmp(ext, ".jpg") == 0 || strcasecmp(ext, ".jpeg") == 0);
+} // isJPEG()
+
+bool DirectoryFrameSource::complete( const char *file ) 
+{
+  unsigned char eoi [2]; 
+  FILE *fp = fopen(file, "rb"); 
+  if (!fp) 
+    return false; 
+  bool ok = (fseek(fp, -2, SEEK_END) == 0 && fread(eoi, 1, 2, fp) == 2 && 
+             eoi[0] == 0xFF && eoi[1] == 0xD9); 
+  fclose(fp); 
+  return ok; 
+} // complete()
+
+void DirectoryFrameSource::settle() 
+/* A file may be complete without ending with the marker, e.g. with bytes
+ * after it, and then no event comes for it. It's taken once its size has
+ * stayed the same for SETTLE_TIME seconds. One that's gone is dropped. */ 
+{
+  time_t now = time(NULL); 
+  struct stat st; 
+  for (int k = 0; k < deferred.size(); ) {
+    deferred_t &d = deferred[k]; 
+    bool gone = (stat(d.name.c_str(), &st) != 0); 
+    if (!gone && st.st_size != d.size) {
+      d.size = st.st_size; 
+      d.since = now; 
+    }
+    if (gone || listed.count(d.name) > 0 || complete(d.name.c_str()) || 
+        now - d.since >= SETTLE_TIME) {
+      if (!gone) 
+        add(d.name.c_str()); 
+      deferred.erase(deferred.begin() + k); 
+    }
+    else 
+      k++; 
+  }
+} // settle()
+
+bool DirectoryFrameSource::update() 
+/* Wait up to a quarter second for events, so that an interrupt is noticed
+ * promptly even if the signal isn't delivered to this thread. The 
+ * deferred files are looked at each time. */ 
+{
+  char buf [4096] __attribute__ ((aligned(__alignof__(struct inotify_event)))); 
+  const struct inotify_event *event; 
+  struct pollfd pfd; 
+  pfd.fd = fd; 
+  pfd.events = POLLIN; 
+
+  ssize_t len = 0; 
+  if (poll(&pfd, 1, 250) > 0) 
+    len = ::read(fd, buf, sizeof(buf)); 
+
+  bool gone = false; 
+  for (char *p = buf; p < buf + len; p += sizeof(struct inotify_event) + event->len) {
+    event = (const struct inotify_event *)p; 
+    if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) 
+      gone = true; 
+    else if (event->len > 0) 
+      add((dir + "/" + event->name).c_str()); 
+  }
+  settle(); 
+  return !gone; 
+} // update()
+
+int DirectoryFrameSource::size() const
+{
+  pthread_mutex_lock(&lock); 
+  int ct = names.size(); 
+  pthread_mutex_unlock(&lock); 
+  return ct;
+} // size()
+
+bool DirectoryFrameSource::wait( int i )
+{
+  while (i >= size()) {
+    if (closed || interrupted) 
+      return false; 
+    if (!update()) 
+      closed = true; 
+  }
+  return true; 
+} // wait()
+
+const char *DirectoryFrameSource::name( int i ) const
+{
+  pthread_mutex_lock(&lock); 
+  const char *name = names[i].c_str(); 
+  pthread_mutex_unlock(&lock); 
+  return name;
+} // name()
+
+void DirectoryFrameSource::read( cv::Mat &img, int i )
+{
+  ::read(img, name(i), options);
+} // read()
+
+void DirectoryFrameSource::original( cv::Mat &img, int i )
+{
+  img = cv::imread(name(i)); 
+} // original()
+
+
+/**
+ * Frame store
+ */
+
+void pack( const char *fn, FrameBuffer &frames, const param_t &options ) 
+/* Write the header and offset table last, once the planes are in place. 
+ * Planes start on a page boundary. */ 
+{
+  store_header_t header; 
+  std::vector<int64_t> offsets(frames.size()); 
+  cv::Mat img; 
+  int i, j; 
+  long pos; 
+
+  FILE *fp = fopen(fn, "wb"); 
+  if (!fp) 
+    die("error: can't open frame store for writing"); 
+
+  memset(&header, 0, sizeof(header)); 
+  strcpy(header.magic, STORE_MAGIC); 
+  header.version = STORE_VERSION; 
+  header.count = frames.size(); 
+  header.shrink_factor = options.shrink_factor; 
+
+  pos = sizeof(header) + offsets.size() * sizeof(int64_t); 
+  pos = (pos + 4095) & ~4095L; 
+
+  for (i = 0; i < frames.size(); i++) {
+    img = frames[i]; 
+    if (i == 0) {
+      header.rows = img.rows; 
+      header.cols = img.cols; 
+    }
+    else if (img.rows != header.rows || img.cols != header.cols) 
+      die("error: frames in stream differ in size"); 
+
+    offsets[i] = pos; 
+    fseek(fp, pos, SEEK_SET); 
+    for (j = 0; j < img.rows; j++) 
+      fwrite(img.ptr<uchar>(j), 1, img.cols, fp); 
+    pos += (long)img.rows * img.cols; 
+  }
+
+  header.names = pos; 
+  fseek(fp, pos, SEEK_SET); 
+  for (i = 0; i < frames.size(); i++) 
+    fwrite(frames.name(i), 1, strlen(frames.name(i)) + 1, fp); 
+
+  fseek(fp, 0, SEEK_SET); 
+  fwrite(&header, sizeof(header), 1, fp); 
+  if (!offsets.empty()) 
+    fwrite(&offsets[0], sizeof(int64_t), offsets.size(), fp); 
+
+  if (ferror(fp) || fclose(fp) != 0) 
+    die("error: can't write frame store"); 
+} // pack() 
+
+
+/**
+ * class MappedFrameSource
+ */
+
+MappedFrameSource::MappedFrameSource( const char *fn, const param_t &o ) 
+  : options(o)
+/* Everything the header and offset table point at must lie in the file. */ 
+{
+  struct stat st; 
+  int fd = open(fn, O_RDONLY); 
+  if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(store_header_t)) 
+    die("error: can't open frame store"); 
+
+  length = st.st_size; 
+  base = (uchar *)mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0); 
+  close(fd); 
+  if (base == MAP_FAILED) 
+    die("error: can't map frame store"); 
+
+  header = (const store_header_t *)base; 
+  offsets = (const int64_t *)(base + sizeof(store_header_t)); 
+  if (strncmp(header->magic, STORE_MAGIC, sizeof(header->magic)) != 0 || 
+      header->version != STORE_VERSION) 
+    die("error: not a frame store, or wrong version"); 
+
+  if (header->count < 0 || header->rows <= 0 || header->cols <= 0 || 
+      header->shrink_factor <= 0 || 
+      header->count > (length - sizeof(store_header_t)) / sizeof(int64_t)) 
+    die("error: frame store is corrupt"); 
+
+  int64_t plane = (int64_t)header->rows * header->cols; 
+  for (int i = 0; i < header->count; i++) 
+    if (offsets[i] < 0 || offsets[i] > (int64_t)length - plane) 
+      die("error: frame store is corrupt"); 
+
+  if (options.shrink_factor % header->shrink_factor != 0) 
+    die("error: shrink factor must be a multiple of the frame store's"); 
+
+  const char *p = (const char *)base + header->names, 
+             *end = (const char *)base + length; 
+  if (header->names < 0 || header->names > (int64_t)length) 
+    die("error: frame store is corrupt"); 
+  for (int i = 0; i < header->count; i++) {
+    const char *q = (const char *)memchr(p, '\0', end - p); 
+    if (!q) 
+      die("error: frame store is corrupt"); 
+    names.push_back(p); 
+    p = q + 1; 
+  }
+} // constr
+
+MappedFrameSource::~MappedFrameSource() 
+{
+  munmap(base, length); 
+} // destr
+
+bool MappedFrameSource::isStore( const char *fn ) 
+{
+  char magic [8]; 
+  FILE *fp = fopen(fn, "rb"); 
+  if (!fp) 
+    return false; 
+  bool store = (fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && 
+                strcmp(magic, STORE_MAGIC) == 0); 
+  fclose(fp); 
+  return store; 
+} // isStore()
+
+int MappedFrameSource::size() const
+{
+  return header->count;
+} // size()
+
+const char *MappedFrameSource::name( int i ) const
+{
+  return names[i];
+} // name()
+
+void MappedFrameSource::read( cv::Mat &img, int i )
+/* Wrap the plane in a header, no copy. */ 
+{
+  cv::Mat plane(header->rows, header->cols, CV_8UC1, base + offsets[i]); 
+  int factor = options.shrink_factor / header->shrink_factor; 
+  if (factor == 1) 
+    img = plane; 
+  else 
+    cv::resize(plane, img, cv::Size(plane.cols/factor, plane.rows/factor)); 
+} // read()
+
+void MappedFrameSource::original( cv::Mat &img, int i )
+/* The store only has the shrunk grayscale frame. Use the original file 
+ * if it's still around. */ 
+{
+  img = cv::imread(names[i]); 
+  if (img.empty()) { /* scale back up, so blobs still line up */ 
+    cv::Mat plane(header->rows, header->cols, CV_8UC1, base + offsets[i]); 
+    cv::resize(plane, img, cv::Size(plane.cols * header->shrink_factor, 
+                                    plane.rows * header->shrink_factor)); 
+    cv::cvtColor(img, img, CV_GRAY2BGR); 
+  }
+} // original()
+
+
+FrameSource *openFrames( std::vector<std::string> &names, 
+                         const param_t &options, std::istream &in ) 
+{
+  if (options.follow[0] != '\0') 
+    return new DirectoryFrameSource( options.follow, options ); 
+
+  if (options.input[0] != '\0' && MappedFrameSource::isStore( options.input )) 
+    return new MappedFrameSource( options.input, options ); 
+  
+  if (options.input[0] != '\0') 
+    return new VideoFrameSource( options.input, options ); 
+
+  if (options.index[0] == '\0' || !loadIndex( names, options.index )) {
+    filenames( names, in, options.threads ); 
+    if (options.index[0] != '\0') 
+      saveIndex( names, options.index ); 
+  }
+  return new FileFrameSource( names, options ); 
+} // openFrames()
+
+
+/**
+ * class FrameBuffer
+ */
+
+FrameBuffer::FrameBuffer( FrameSource &s, int capacity, int threads, int depth )
+  : source(s)
+{
+  assert(capacity > 0 && threads >= 0);
+  if (threads > 1 && source.sequential()) 
+    threads = 1; 
+  if (threads > 0 && depth <= 0) 
+    depth = 2 * threads; 
+  if (threads == 0) 
+    depth = 0; 
+
+  keep = capacity; 
+  low = 0; 
+  next = 0; 
+  stop = false; 
+
+  frames.resize(capacity + depth); 
+  indices.resize(capacity + depth, -1); 
+  busy.resize(capacity + depth, false); 
+  failed.resize(capacity + depth, false); 
+  errors.resize(capacity + depth); 
+
+  pthread_mutex_init(&lock, NULL); 
+  pthread_cond_init(&ready, NULL); 
+  pthread_cond_init(&space, NULL); 
+
+  workers.resize(threads); 
+  for (int i = 0; i < threads; i++) 
+    pthread_create(&workers[i], NULL, &FrameBuffer::work, this); 
+} // constr
+
+FrameBuffer::~FrameBuffer() 
+{
+  pthread_mutex_lock(&lock); 
+  stop = true; 
+  pthread_cond_broadcast(&space); 
+  pthread_mutex_unlock(&lock); 
+
+  for (int i = 0; i < workers.size(); i++) 
+    pthread_join(workers[i], NULL); 
+
+  pthread_cond_destroy(&space); 
+  pthread_cond_destroy(&ready); 
+  pthread_mutex_destroy(&lock); 
+} // destr
+
+cv::Mat FrameBuffer::operator[] ( int i )
+/* Frame i lives in slot i % capacity. If the slot holds some other frame,
+ * decode frame i over it. When prefetching, move the window up to i and 
+ * wait for a worker to deliver the frame. */
+{
+  int slot = i % frames.size();
+
+  if (workers.empty()) {
+    if (indices[slot] != i) {
+      source.read(frames[slot], i);
+      indices[slot] = i;
+    }
+    return frames[slot];
+  }
+
+  cv::Mat img; 
+  pthread_mutex_lock(&lock); 
+  
+  if (i - keep + 1 > low) {
+    low = i - keep + 1; 
+    if (next < low)  /* skipped ahead; don't decode frames in between */ 
+      next = low; 
+    pthread_cond_broadcast(&space); 
+  }
+
+  if (i < low) { /* behind the window */ 
+    pthread_mutex_unlock(&lock); 
+    source.read(img, i); 
+    return img; 
+  }
+
+  if (next <= i) /* the stream may have grown since workers last looked */ 
+    pthread_cond_broadcast(&space); 
+  while (indices[slot] != i || busy[slot]) 
+    pthread_cond_wait(&ready, &lock); 
+  
+  if (failed[slot]) {
+    cv::Exception err = errors[slot]; 
+    pthread_mutex_unlock(&lock); 
+    throw err; 
+  }
+
+  img = frames[slot]; 
+  pthread_mutex_unlock(&lock); 
+  return img; 
+} // operator[]
+
+void FrameBuffer::read( cv::Mat &img, int i ) 
+{
+  source.read(img, i); 
+} // read()
+
+void FrameBuffer::original( cv::Mat &img, int i ) 
+{
+  source.original(img, i); 
+} // original()
+
+void *FrameBuffer::work( void *arg ) 
+{
+  ((FrameBuffer *)arg)->work(); 
+  return NULL; 
+} // work()
+
+void FrameBuffer::work() 
+/* Claim the next frame in the window, decode it outside of the lock, and 
+ * hand it over. A frame may only go in its slot once the slot's previous 
+ * occupant has fallen behind the window and is no longer being decoded. */ 
+{
+  int i, slot, n = frames.size(); 
+  cv::Mat img; 
+
+  pthread_mutex_lock(&lock); 
+  while (true) {
+    while (!stop && (next >= source.size() || next >= low + n || 
+                     busy[next % n]))
+      pthread_cond_wait(&space, &lock); 
+    if (stop) 
+      break; 
+
+    i = next++; 
+    slot = i % n; 
+    indices[slot] = i; 
+    busy[slot] = true; 
+
+    /* Decode over the slot's last frame, unless someone still holds it. */
+    img = frames[slot]; 
+    frames[slot] = cv::Mat(); 
+    if (img.refcount == NULL || *img.refcount > 1) 
+      img = cv::Mat(); 
+    pthread_mutex_unlock(&lock); 
+
+    bool ok = true; 
+    cv::Exception err; 
+    try {
+      source.read(img, i); 
+    }
+    catch( cv::Exception &e ) {
+      ok = false; 
+      err = e; 
+    }
+    catch( std::exception &e ) { /* handed over as if OpenCV threw it */ 
+      ok = false; 
+      err = cv::Exception(CV_StsError, e.what(), "FrameBuffer::work", 
+                          __FILE__, __LINE__); 
+    }
+    catch( ... ) {
+      ok = false; 
+      err = cv::Exception(CV_StsError, "unknown exception", 
+                          "FrameBuffer::work", __FILE__, __LINE__); 
+    }
+
+    pthread_mutex_lock(&lock); 
+    frames[slot] = img; 
+    failed[slot] = !ok; 
+    errors[slot] = err; 
+    busy[slot] = false; 
+    pthread_cond_broadcast(&ready); 
+    pthread_cond_broadcast(&space); 
+  }
+  pthread_mutex_unlock(&lock); 
+} // work()
+
+int FrameBuffer::size() const
+{
+  return source.size();
+} // size()
+
+bool FrameBuffer::wait( int i ) 
+{
+  return source.wait(i); 
+} // wait()
+
+const char *FrameBuffer::name( int i ) const
+{
+  return source.name(i);
+} // name()
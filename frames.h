@@ -0,0 +1,325 @@
+/* John Muir Institute for the Environment
+ * University of California, Davis
+ *
+ * frames.h
+ * Sources of video frames for the image processing pipeline. A frame
+ * source decodes frames by time index; a frame buffer keeps the most
+ * recently decoded frames so that the sliding delta reads each frame from
+ * disk exactly once. This file is part of the Salamander project.
+ *
+ * Copyright (C) 2013 Christopher Patton
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAMES_H
+#define FRAMES_H
+
+#include "salamander.h"
+#include "files.h"
+#include <vector>
+#include <string>
+#include <deque>
+#include <set>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+
+/**
+ * class FrameSource - a video stream indexed by time. Frames are decoded
+ * and prepared for the processing pipeline (grayscale, shrunk by the
+ * shrink factor).
+ */
+
+class FrameSource {
+public:
+
+  virtual ~FrameSource();
+
+  /* Number of frames in stream. */
+  virtual int size() const = 0;
+
+  /* Block until frame i is available. Return false if the stream ends
+   * before it is. */ 
+  virtual bool wait( int i );
+
+  /* Name of frame i, used for labeling output. */
+  virtual const char *name( int i ) const = 0;
+
+  /* Decode frame i. */
+  virtual void read( cv::Mat &img, int i ) = 0;
+
+  /* Decode frame i as is (color, full size), for output. */ 
+  virtual void original( cv::Mat &img, int i ) = 0;
+
+  /* Frames are cheapest to decode in order; seeking is expensive. */ 
+  virtual bool sequential() const;
+
+};
+
+
+/**
+ * class FileFrameSource - a stream of JPEG files, as given by filenames().
+ */
+
+class FileFrameSource : public FrameSource {
+public:
+
+  FileFrameSource( const std::vector<std::string> &names,
+                   const param_t &options );
+
+  int size() const;
+  const char *name( int i ) const;
+  void read( cv::Mat &img, int i );
+  void original( cv::Mat &img, int i );
+
+private:
+
+  const std::vector<std::string> &names;
+  const param_t &options;
+
+};
+
+
+/**
+ * class VideoFrameSource - frames demuxed and decoded from a video 
+ * container (AVI, MJPEG, MP4, ...) by cv::VideoCapture. The time index 
+ * of a frame is its frame number. Frame i is named <file>-<i>.jpg. 
+ */
+
+class VideoFrameSource : public FrameSource {
+public:
+
+  VideoFrameSource( const char *fn, const param_t &options ); 
+  ~VideoFrameSource(); 
+
+  int size() const;
+  const char *name( int i ) const;
+  void read( cv::Mat &img, int i );
+  void original( cv::Mat &img, int i );
+  bool sequential() const;
+
+private:
+
+  /* Decode frame i into the capture buffer. */ 
+  bool decode( int i ); 
+
+  cv::VideoCapture capture; 
+  const param_t &options;
+  std::vector<std::string> names;
+  int pos;                      /* frame number of next frame in capture */ 
+  cv::Mat frame;                /* last frame decoded */ 
+  pthread_mutex_t lock; 
+
+};
+
+
+/**
+ * class DirectoryFrameSource - a live stream of JPEG files dropped in a 
+ * directory by a camera. The files already there are taken first, in 
+ * alphanumeric order, except ones that don't end with the JPEG end of 
+ * image marker yet. Those are deferred until an event for them comes, 
+ * or they do end with it, or their size has stayed put for a while. Each
+ * new file is appended as soon as it is fully written (closed, or moved
+ * into the directory). A file is only taken once, however many events 
+ * come for it. The stream ends when the directory goes away or on 
+ * interrupt(). Only one thread may wait() on it. 
+ */
+
+class DirectoryFrameSource : public FrameSource {
+public:
+
+  DirectoryFrameSource( const char *dir, const param_t &options ); 
+  ~DirectoryFrameSource(); 
+
+  int size() const;
+  bool wait( int i );
+  const char *name( int i ) const;
+  void read( cv::Mat &img, int i );
+  void original( cv::Mat &img, int i );
+
+  /* End the stream; safe to use as a signal handler. */ 
+  static void interrupt( int sig ); 
+
+private:
+
+  /* Append a file to the stream if it's a non-empty JPEG that isn't in
+   * it yet. */ 
+  void add( const char *file ); 
+
+  /* Check that a file is named as a JPEG. */ 
+  static bool isJPEG( const char *file ); 
+
+  /* Check that a file ends with the JPEG end of image marker. */ 
+  static bool complete( const char *file ); 
+
+  /* Take the deferred files that are done being written. */ 
+  void settle(); 
+
+  /* Handle pending inotify events. Return false if the directory is 
+   * gone. */ 
+  bool update(); 
+
+  static volatile sig_atomic_t interrupted; 
+
+  std::string dir; 
+  const param_t &options;
+  std::deque<std::string> names; /* elements don't move as it grows */ 
+  std::set<std::string> listed;  /* files in the stream */ 
+
+  struct deferred_t {
+    std::string name; 
+    off_t size;                  /* when last looked at */ 
+    time_t since;                /* the size last changed */ 
+  }; 
+  std::vector<deferred_t> deferred; /* of the initial scan */ 
+  int fd;                        /* inotify instance */ 
+  bool closed; 
+  mutable pthread_mutex_t lock; 
+
+};
+
+
+/**
+ * struct store_header_t - header of a frame store, a file of frames 
+ * already decoded and shrunk for the processing pipeline. It is followed
+ * by a table of count offsets to the pixel planes, the planes themselves 
+ * (rows * cols bytes each, row major), and a table of count NUL terminated
+ * frame names. Integers are in host byte order. 
+ */ 
+
+#define STORE_MAGIC "SALFRMS"
+#define STORE_VERSION 1
+
+struct store_header_t {
+  char magic [8]; 
+  int32_t version; 
+  int32_t count;          /* number of frames */ 
+  int32_t rows, cols;     /* dimensions of every frame */ 
+  int32_t shrink_factor;  /* frames were shrunk by this factor */ 
+  int32_t reserved; 
+  int64_t names;          /* offset of name table */ 
+}; 
+
+/**
+ * Write frames 0 to frames.size()-1 to a frame store. 
+ */ 
+void pack( const char *fn, FrameBuffer &frames, const param_t &options ); 
+
+
+/**
+ * class MappedFrameSource - a frame store produced by pack(), mapped 
+ * into memory. If the shrink factor matches the store's, frames are 
+ * handed out as headers over the mapping without copying. A larger 
+ * multiple of it is applied with cv::resize(). The mapping is read 
+ * only, so frames must not be written to in place. The constructor dies
+ * on a store whose header or offsets don't fit the file. 
+ */
+
+class MappedFrameSource : public FrameSource {
+public:
+
+  MappedFrameSource( const char *fn, const param_t &options ); 
+  ~MappedFrameSource(); 
+
+  /* Check for a frame store. */ 
+  static bool isStore( const char *fn ); 
+
+  int size() const;
+  const char *name( int i ) const;
+  void read( cv::Mat &img, int i );
+  void original( cv::Mat &img, int i );
+
+private:
+
+  const param_t &options;
+  uchar *base;                  /* mapping, read only */ 
+  size_t length; 
+  const store_header_t *header; 
+  const int64_t *offsets;       /* offset of each plane */ 
+  std::vector<const char *> names; 
+
+};
+
+
+/**
+ * Open the frame source given by the command line options: the directory
+ * given with --follow, the video file or frame store given with -i, or 
+ * else a list of JPEG files from the index given with -x or on in. The 
+ * names of the files are stored in names. 
+ */ 
+FrameSource *openFrames( std::vector<std::string> &names, 
+                         const param_t &options, std::istream &in ); 
+
+
+/**
+ * class FrameBuffer - a ring buffer of decoded frames. Slot i % capacity
+ * holds frame i, so a sliding window over the stream decodes each frame
+ * once. The returned header shares its data with the buffer. 
+ *
+ * If threads > 0, a pool of workers decodes up to depth frames ahead of 
+ * the last one requested. Frames are handed out strictly by index, so the 
+ * consumer sees the same stream regardless of the number of workers. The 
+ * window of retained frames only moves forward; a request behind it is 
+ * decoded synchronously and isn't buffered. A worker decodes over the 
+ * buffer of the frame it replaces, unless that frame is still held. 
+ */
+
+class FrameBuffer {
+public:
+
+  FrameBuffer( FrameSource &source, int capacity=2, int threads=0, 
+                                                    int depth=0 );
+  ~FrameBuffer(); 
+
+  /* Get frame i, decoding it if it isn't buffered. */
+  cv::Mat operator[] ( int i );
+
+  /* Decode frame i into img, bypassing the buffer. */ 
+  void read( cv::Mat &img, int i ); 
+  void original( cv::Mat &img, int i ); 
+
+  int size() const;
+  bool wait( int i );
+  const char *name( int i ) const;
+
+private:
+
+  /* Prefetch worker */ 
+  static void *work( void *arg ); 
+  void work(); 
+
+  FrameSource &source;
+  std::vector<cv::Mat> frames;  /* decoded frames */
+  std::vector<int> indices;     /* time index of each slot */
+  std::vector<bool> busy;       /* slot is being decoded */ 
+  std::vector<bool> failed;     /* decoding slot raised an exception */ 
+  std::vector<cv::Exception> errors; 
+
+  int keep;                     /* frames retained behind the last request */ 
+  int low;                      /* lowest index still retained */ 
+  int next;                     /* next index to prefetch */ 
+  bool stop; 
+
+  std::vector<pthread_t> workers; 
+  pthread_mutex_t lock; 
+  pthread_cond_t ready;         /* a slot has been decoded */ 
+  pthread_cond_t space;         /* the window has moved forward */ 
+
+};
+
+#endif
@@ -0,0 +1,243 @@
+/* John Muir Institute for the Environment
+ * University of California, Davis
+ *
+ * gaps.cpp
+ * Checking the gaps between chunks for a target in the background. This
+ * file is part of the Salamander project.
+ *
+ * Copyright (C) 2013 Christopher Patton
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gaps.h"
+#include <iostream>
+#include <cstdio>
+#include <algorithm>
+#include <assert.h>
+
+/**
+ * class GapChecker
+ */
+
+GapChecker::GapChecker( FrameBuffer &frames, const param_t &options,
+                        int threads )
+  : frames(frames), options(options)
+{
+  assert(threads >= 0);
+  stop = false;
+
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&queued, NULL);
+  pthread_cond_init(&done, NULL);
+
+  workers.resize(threads);
+  for (int i = 0; i < threads; i++)
+    pthread_create(&workers[i], NULL, &GapChecker::work, this);
+} // constr
+
+GapChecker::~GapChecker()
+{
+  pthread_mutex_lock(&lock);
+  stop = true;
+  pthread_cond_broadcast(&queued);
+  pthread_mutex_unlock(&lock);
+
+  for (int i = 0; i < workers.size(); i++)
+    pthread_join(workers[i], NULL);
+
+  pthread_cond_destroy(&done);
+  pthread_cond_destroy(&queued);
+  pthread_mutex_destroy(&lock);
+} // destr
+
+int GapChecker::away( const Chunks &chunks, int c, const Blob &region )
+/* Back from the last track of chunk c to the last one the target isn't
+ * on, unless a chunk after that one is known to have an empty gap before
+ * it. */
+{
+  int k = chunks.lastAway(chunks[c].end_index + 1, region);
+  c = chunks.lastKnown();
+  if (c >= 0 && chunks[c].first > k)
+    return chunks[c].start_index - 1;
+  else if (k >= 0)
+    return chunks.track(k).index;
+  else
+    return 0;
+} // away()
+
+void GapChecker::check( const Chunks &chunks )
+{
+  int c = chunks.size() - 1;
+  assert(c > 0);
+
+  job_t job;
+  job.end = chunks[c - 1].end_index;
+  job.start = chunks[c].start_index;
+  job.region = chunks.endPos(c - 1);
+  job.i = away(chunks, c, job.region);
+  job.j = (job.end + job.start) / 2;
+  job.persists = job.failed = false;
+  job.state = QUEUED;
+
+  if (workers.empty()) {
+    run(ws, job);
+    job.state = DONE;
+  }
+
+  pthread_mutex_lock(&lock);
+  jobs.push_back(job);
+  pthread_cond_signal(&queued);
+  pthread_mutex_unlock(&lock);
+} // check()
+
+void GapChecker::reconcile( Chunks &chunks, bool wait )
+/* Merging doesn't change which gaps are known or where the tracks are,
+ * only the numbering of the chunks, so the gaps the target persists over
+ * are merged across last, in runs of adjacent chunks, from the back. */
+{
+  std::vector<int> across;      /* start of chunks to merge with the one before */
+  std::vector<job_t> decided;
+  bool failed = false;
+  cv::Exception error;
+
+  pthread_mutex_lock(&lock);
+  while (!jobs.empty()) {
+    job_t &job = jobs.front();
+    while (wait && job.state != DONE)
+      pthread_cond_wait(&done, &lock);
+    if (job.state != DONE)
+      break;
+    if (job.failed) {
+      failed = true;
+      error = job.error;
+      jobs.pop_front();
+      break;
+    }
+
+    int c = chunks.find(job.start), i = away(chunks, c, job.region);
+    if (i != job.i) { /* a gap before was empty */
+      job.i = i;
+      if (workers.empty()) {
+        pthread_mutex_unlock(&lock);
+        run(ws, job);
+        pthread_mutex_lock(&lock);
+      }
+      else {
+        job.state = QUEUED;
+        pthread_cond_signal(&queued);
+      }
+      continue;
+    }
+
+    std::cout << "Try comparing " << frames.name(std::min(job.i, job.j))
+              << " with " << frames.name(std::max(job.i, job.j)) << std::endl;
+    if (job.persists)
+      across.push_back(job.start);
+    else
+      chunks.gapKnown(c, true); /* preceeding gap known to be empty */
+    decided.push_back(job);
+    jobs.pop_front();
+  }
+  pthread_mutex_unlock(&lock);
+
+  for (int k = 0; k < decided.size(); k++)
+    output(decided[k]);
+
+  for (int k = across.size() - 1, n; k >= 0; k -= n) {
+    int c = chunks.find(across[k]);
+    for (n = 1; n <= k && chunks.find(across[k - n]) == c - n; n++)
+      ;
+    chunks.merge(c - n, c);
+  }
+
+  if (failed)
+    throw error;
+} // reconcile()
+
+void GapChecker::run( Workspace &ws, job_t &job )
+{
+  int i = std::min(job.i, job.j), j = std::max(job.i, job.j);
+  frames.read(ws.A, i);
+  frames.read(ws.B, j);
+  cv::Rect r = job.region.GetRegion();
+
+  ws.detect(ws.A(r), ws.B(r), options);
+  job.persists = (ws.blobs.size() > 0);
+  ws.image().copyTo(job.mask);
+} // run()
+
+void GapChecker::output( const job_t &job )
+{
+  int i = std::min(job.i, job.j), j = std::max(job.i, job.j);
+  char out [1024];
+  snprintf(out, sizeof(out), "blob-%s-%s.jpg", baseName(frames.name(i)), 
+           baseName(frames.name(j)));
+  if (!cv::imwrite(out, job.mask))
+    std::cerr << "can't write " << out << std::endl;
+} // output()
+
+void *GapChecker::work( void *arg )
+{
+  ((GapChecker *)arg)->work();
+  return NULL;
+} // work()
+
+void GapChecker::work()
+/* Take the oldest job that is queued and check it outside of the lock.
+ * Only the queuing thread adds and removes jobs, at the ends, so the job
+ * stays put while it's checked. */
+{
+  Workspace ws;
+  std::deque<job_t>::iterator it;
+
+  pthread_mutex_lock(&lock);
+  while (true) {
+    for (it = jobs.begin(); it != jobs.end() && it->state != QUEUED; ++it)
+      ;
+    if (stop)
+      break;
+    if (it == jobs.end()) {
+      pthread_cond_wait(&queued, &lock);
+      continue;
+    }
+
+    job_t &job = *it;
+    job.state = CHECKING;
+    pthread_mutex_unlock(&lock);
+
+    try {
+      run(ws, job);
+    }
+    catch( cv::Exception &e ) {
+      job.failed = true;
+      job.error = e;
+    }
+    catch( std::exception &e ) { /* handed over as if OpenCV threw it */
+      job.failed = true;
+      job.error = cv::Exception(CV_StsError, e.what(), "GapChecker::work",
+                                __FILE__, __LINE__);
+    }
+    catch( ... ) {
+      job.failed = true;
+      job.error = cv::Exception(CV_StsError, "unknown exception",
+                                "GapChecker::work", __FILE__, __LINE__);
+    }
+
+    pthread_mutex_lock(&lock);
+    job.state = DONE;
+    pthread_cond_broadcast(&done);
+  }
+  pthread_mutex_unlock(&lock);
+} // work()
@@ -0,0 +1,115 @@
+/* John Muir Institute for the Environment
+ * University of California, Davis
+ *
+ * gaps.h
+ * Checking the gaps between chunks for a target in the background. This
+ * file is part of the Salamander project.
+ *
+ * Copyright (C) 2013 Christopher Patton
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GAPS_H
+#define GAPS_H
+
+#include "salamander.h"
+#include "chunks.h"
+#include "frames.h"
+#include "workspace.h"
+#include <deque>
+#include <pthread.h>
+
+
+/**
+ * class GapChecker - a queue of gaps between chunks to be checked for a
+ * target, drained by a pool of workers, each with its own Workspace. The
+ * target persists over a gap if the region where it was last seen
+ * differs between the middle of the gap and the last frame before it
+ * that the target is known to have been away from that region.
+ *
+ * That frame depends on which of the gaps before are empty, so a gap is
+ * checked against the frame it would be if the ones still being checked
+ * aren't. Gaps are reconciled with the chunks in the order they were
+ * queued; if the frame turns out to be another one, the gap is queued
+ * again with it, so the decisions are the same as checking each gap in
+ * turn. The mask of the check that decides a gap is written to a file 
+ * named after the frames it compared, once the gap is reconciled.
+ *
+ * The comparison of a gap is printed when it's reconciled, so with 
+ * workers it may come after the output for frames scanned later than 
+ * the gap; the lines and the chunks are the same, the order isn't. With 
+ * no workers, a gap is checked on the calling thread when it is queued,
+ * and output is in scan order. Only one thread may queue and reconcile
+ * gaps.
+ */
+
+class GapChecker {
+public:
+
+  GapChecker( FrameBuffer &frames, const param_t &options, int threads );
+  ~GapChecker();
+
+  /* Queue the gap before the last chunk. */
+  void check( const Chunks &chunks );
+
+  /* Merge the chunks on either side of the gaps the target persists
+   * over, and mark the others known to be empty, oldest first. Stop at
+   * the first gap that hasn't been checked, or with wait, wait for it. */
+  void reconcile( Chunks &chunks, bool wait=false );
+
+private:
+
+  enum state_t { QUEUED, CHECKING, DONE };
+
+  struct job_t {
+    int end, start;             /* of the chunks before and after */
+    Blob region;                /* last position before */
+    int i, j;                   /* frames compared */
+    bool persists;
+    cv::Mat mask;               /* of the last check */
+    bool failed;
+    cv::Exception error;
+    state_t state;
+  };
+
+  /* The last frame up to chunk c in which the target is known to be away
+   * from region. */
+  static int away( const Chunks &chunks, int c, const Blob &region );
+
+  /* Compare frames i and j of the job in its region. */
+  void run( Workspace &ws, job_t &job );
+
+  /* Write the mask of a job that was reconciled. */
+  void output( const job_t &job );
+
+  /* Worker */
+  static void *work( void *arg );
+  void work();
+
+  FrameBuffer &frames;
+  const param_t &options;
+  std::deque<job_t> jobs;       /* not yet reconciled, oldest first */
+  bool stop;
+
+  Workspace ws;                 /* when not threaded */
+
+  std::vector<pthread_t> workers;
+  pthread_mutex_t lock;
+  pthread_cond_t queued;        /* a job was queued */
+  pthread_cond_t done;          /* a job was checked */
+
+};
+
+#endif
@@ -0,0 +1,399 @@
+/* John Muir Institute for the Environment
+ * University of California, Davis
+ *
+ * mask.cpp
+ * A binary image stored one bit per pixel. This file is part of the
+ * Salamander project.
+ *
+ * Copyright (C) 2013 Christopher Patton
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mask.h"
+#include <algorithm>
+#include <cstring>
+#include <assert.h>
+
+
+void halfWidths( std::vector<int> &dx, int r, int shape )
+/* Take them from OpenCV, so that the element is exactly the one 
+ * cv::erode() would use. */
+{
+  cv::Mat e = cv::getStructuringElement( 
+                shape == SHAPE_RECT ? cv::MORPH_RECT : cv::MORPH_ELLIPSE,
+                cv::Size( 2*r + 1, 2*r + 1 ), cv::Point( r, r ) );
+  dx.resize(r + 1);
+  for (int dy = 0; dy <= r; dy++) {
+    const uchar *p = e.ptr<uchar>(r + dy);
+    int ct = 0;
+    for (int j = 0; j < e.cols; j++)
+      ct += (p[j] != 0);
+    dx[dy] = (ct - 1) / 2;
+  }
+} // halfWidths()
+
+int innerSquare( const std::vector<int> &dx )
+{
+  int t = 0; 
+  while (t + 1 < dx.size()) {
+    bool fits = true; 
+    for (int dy = 0; dy <= t + 1; dy++) 
+      fits = fits && dx[dy] >= t + 1; 
+    if (!fits) 
+      break; 
+    t++; 
+  }
+  return 2*t + 1; 
+} // innerSquare()
+
+static void shiftDown( uint64_t *y, int n, int s )
+/* y[j] |= y[j+s], for a row of n words. Each word only reads words at
+ * or above it, so this can go in place from the bottom up. */
+{
+  int ws = s >> 6, bs = s & 63;
+  for (int k = 0; k + ws < n; k++) {
+    uint64_t v = y[k + ws] >> bs;
+    if (bs && k + ws + 1 < n)
+      v |= y[k + ws + 1] << (64 - bs);
+    y[k] |= v;
+  }
+} // shiftDown()
+
+static void shiftUp( uint64_t *y, int n, int s )
+/* y[j] |= y[j-s]. In place from the top down. */
+{
+  int ws = s >> 6, bs = s & 63;
+  for (int k = n - 1; k - ws >= 0; k--) {
+    uint64_t v = y[k - ws] << bs;
+    if (bs && k - ws - 1 >= 0)
+      v |= y[k - ws - 1] >> (64 - bs);
+    y[k] |= v;
+  }
+} // shiftUp()
+
+static void spread( const uint64_t *x, uint64_t *out, uint64_t *tmp,
+                    int n, int d )
+/* out[j] |= x[j-d] | ... | x[j+d]. Pixels outside of the row are clear.
+ * Each half of the window, x[j..j+d] and x[j-d..j], is ORed together by
+ * doubling the span of shifts, so it takes O(log d) passes over the row.
+ * (Doing the whole window at once would need room past the ends of the
+ * row.) */
+{
+  void (*shift[2])( uint64_t*, int, int ) = { shiftDown, shiftUp };
+  for (int h = 0; h < 2; h++) {
+    int span = 1;
+    memcpy(tmp, x, n * sizeof(uint64_t));
+    while (2*span <= d + 1) {
+      shift[h](tmp, n, span);
+      span *= 2;
+    }
+    if (span < d + 1)
+      shift[h](tmp, n, d + 1 - span);
+    for (int k = 0; k < n; k++)
+      out[k] |= tmp[k];
+  }
+} // spread()
+
+static bool zero( const uint64_t *x, int n )
+{
+  for (int k = 0; k < n; k++)
+    if (x[k])
+      return false;
+  return true;
+} // zero()
+
+
+/**
+ * class Elements
+ */
+
+const std::vector<int> &Elements::get( int r, int shape )
+{
+  size_t k = 2 * (size_t)r + (shape == SHAPE_RECT);
+  if (cache.size() <= k)
+    cache.resize(k + 1);
+  if (cache[k].empty())
+    halfWidths(cache[k], r, shape);
+  return cache[k];
+} // get()
+
+
+/**
+ * class BitMask
+ */
+
+BitMask::BitMask()
+{
+  nrows = ncols = nwords = 0;
+} // constr
+
+BitMask::BitMask( int rows, int cols )
+{
+  create(rows, cols);
+} // constr
+
+void BitMask::create( int rows, int cols )
+{
+  nrows = rows;
+  ncols = cols;
+  nwords = (cols + 63) / 64;
+  bits.assign((size_t)nrows * nwords, 0);
+} // create()
+
+int BitMask::rows() const
+{
+  return nrows;
+} // rows()
+
+int BitMask::cols() const
+{
+  return ncols;
+} // cols()
+
+int BitMask::words() const
+{
+  return nwords;
+} // words()
+
+uint64_t *BitMask::row( int i )
+{
+  return &bits[(size_t)i * nwords];
+} // row()
+
+const uint64_t *BitMask::row( int i ) const
+{
+  return &bits[(size_t)i * nwords];
+} // row() const
+
+bool BitMask::get( int i, int j ) const
+{
+  return (row(i)[j >> 6] >> (j & 63)) & 1;
+} // get()
+
+bool BitMask::empty() const
+/* Most frames are idle, so this is asked of a mask with nothing set far
+ * more often than not. OR blocks of eight words together, which the 
+ * compiler can do in vector registers, and test once per block. */ 
+{
+  const uint64_t *p = bits.empty() ? NULL : &bits[0];
+  size_t n = bits.size(), k = 0;
+  for (; k + 8 <= n; k += 8)
+    if (p[k] | p[k+1] | p[k+2] | p[k+3] | p[k+4] | p[k+5] | p[k+6] | p[k+7])
+      return false;
+  for (; k < n; k++)
+    if (p[k])
+      return false;
+  return true;
+} // empty()
+
+void BitMask::toMat( cv::Mat &img ) const
+{
+  img.create(nrows, ncols, CV_8UC1);
+  for (int i = 0; i < nrows; i++) {
+    uchar *p = img.ptr<uchar>(i);
+    for (int j = 0; j < ncols; j++)
+      p[j] = get(i, j) ? 255 : 0;
+  }
+} // toMat()
+
+void BitMask::fromMat( const cv::Mat &img )
+{
+  CV_Assert(img.type() == CV_8UC1);
+  create(img.rows, img.cols);
+  for (int i = 0; i < nrows; i++) {
+    const uchar *p = img.ptr<uchar>(i);
+    uint64_t *q = row(i);
+    for (int j = 0; j < ncols; j++)
+      if (p[j])
+        q[j >> 6] |= (uint64_t)1 << (j & 63);
+  }
+} // fromMat()
+
+void BitMask::trim( uint64_t *r ) const
+{
+  if (ncols & 63)
+    r[nwords - 1] &= ((uint64_t)1 << (ncols & 63)) - 1;
+} // trim()
+
+void BitMask::invert()
+{
+  for (size_t k = 0; k < bits.size(); k++)
+    bits[k] = ~bits[k];
+  for (int i = 0; i < nrows; i++)
+    trim(row(i));
+} // invert()
+
+void BitMask::erode( int r, int shape, int engine )
+{
+  if (r <= 0 || nrows == 0)
+    return;
+
+  if (engine == ENGINE_SHIFT)
+    shiftErode(elements.get(r, shape));
+  else { /* the element is symmetric, so no need to reflect it */
+    invert();
+    linearDilate(r, shape);
+    invert();
+  }
+} // erode()
+
+void BitMask::dilate( int r, int shape, int engine )
+{
+  if (r <= 0 || nrows == 0)
+    return;
+
+  if (engine == ENGINE_SHIFT)
+    shiftDilate(elements.get(r, shape));
+  else
+    linearDilate(r, shape);
+} // dilate()
+
+void BitMask::shiftDilate( const std::vector<int> &dx )
+/* Each row s that has a pixel set is spread sideways by the half width
+ * of row dy of the element and ORed into rows s-dy and s+dy. Pixels
+ * outside of the image are clear, so they never dilate into it. */
+{
+  int r = dx.size() - 1;
+  scratch.assign(bits.size(), 0);
+  line.resize(nwords);
+  tmp.resize(nwords);
+
+  for (int s = 0; s < nrows; s++) {
+    const uint64_t *x = row(s);
+    if (zero(x, nwords))
+      continue;
+    for (int dy = 0; dy <= r; dy++) {
+      if (s - dy < 0 && s + dy >= nrows)
+        break;
+      std::fill(line.begin(), line.end(), 0);
+      spread(x, &line[0], &tmp[0], nwords, dx[dy]);
+      if (s - dy >= 0)
+        for (int k = 0; k < nwords; k++)
+          scratch[(size_t)(s - dy) * nwords + k] |= line[k];
+      if (dy > 0 && s + dy < nrows)
+        for (int k = 0; k < nwords; k++)
+          scratch[(size_t)(s + dy) * nwords + k] |= line[k];
+    }
+  }
+
+  bits.swap(scratch);
+  for (int i = 0; i < nrows; i++)
+    trim(row(i));
+} // shiftDilate()
+
+void BitMask::shiftErode( const std::vector<int> &dx )
+/* Row i of the output is row i ANDed with every row s within the element,
+ * each shrunk sideways by the half width of row i - s. Shrinking is
+ * spreading the complement. Pixels outside of the image are set, so they
+ * never erode it: rows past the top and bottom are skipped, and the
+ * complement is clear past the ends of a row. Only rows with a pixel
+ * set can survive, and each stops as soon as it's empty. */
+{
+  int r = dx.size() - 1;
+  scratch.assign(bits.size(), 0);
+  inv.resize(nwords);
+  line.resize(nwords);
+  tmp.resize(nwords);
+
+  for (int i = 0; i < nrows; i++) {
+    uint64_t *acc = &scratch[(size_t)i * nwords];
+    if (zero(row(i), nwords))
+      continue;
+    memcpy(acc, row(i), nwords * sizeof(uint64_t));
+
+    for (int dy = 0; dy <= r && !zero(acc, nwords); dy++) {
+      for (int s = i - dy; s <= i + dy; s += (dy ? 2*dy : 1)) {
+        if (s < 0 || s >= nrows)
+          continue;
+        const uint64_t *x = row(s);
+        for (int k = 0; k < nwords; k++)
+          inv[k] = ~x[k];
+        trim(&inv[0]);
+        std::fill(line.begin(), line.end(), 0);
+        spread(&inv[0], &line[0], &tmp[0], nwords, dx[dy]);
+        for (int k = 0; k < nwords; k++)
+          acc[k] &= ~line[k];
+      }
+    }
+  }
+
+  bits.swap(scratch);
+} // shiftErode()
+
+void BitMask::colDistance( int cap )
+/* Two passes over the rows, one from each end, so memory is read in 
+ * order. */
+{
+  dist.resize((size_t)nrows * ncols);
+  edge.assign(ncols, cap - 1);
+  for (int i = 0; i < nrows; i++) {
+    int *d = &dist[(size_t)i * ncols];
+    const int *above = i ? d - ncols : &edge[0];
+    const uint64_t *p = row(i);
+    for (int j = 0; j < ncols; j++) {
+      int v = above[j] + 1;
+      if (v > cap)
+        v = cap;
+      d[j] = ((p[j >> 6] >> (j & 63)) & 1) ? 0 : v;
+    }
+  }
+  for (int i = nrows - 2; i >= 0; i--) {
+    int *d = &dist[(size_t)i * ncols];
+    const int *below = d + ncols;
+    for (int j = 0; j < ncols; j++)
+      if (below[j] + 1 < d[j])
+        d[j] = below[j] + 1;
+  }
+} // colDistance()
+
+void BitMask::linearDilate( int r, int shape )
+/* Every row of the element is a run of pixels centered on its column, and
+ * runs get no wider away from the center row. So of the pixels set in a 
+ * column, the one nearest to row i reaches furthest along it: if it's v 
+ * rows away, it covers the run of half width dx[v] around the column. 
+ * Row i of the output is the union of these runs. A run reaches column j
+ * from the left if its right end is at or past j, and from the right if 
+ * its left end is at or before j, so one sweep each way, carrying the 
+ * furthest reach so far, finds the union. With v from two passes down 
+ * and up the image, that's a few operations per pixel whatever r is. */
+{
+  const int none = -(1 << 30);
+  std::vector<int> &dx = widths;
+  dx = elements.get(r, shape);
+  dx.push_back(none);          /* no pixel within r rows */
+  colDistance(r + 1);
+  std::vector<uchar> &line = pixels;
+  line.resize(ncols);
+
+  for (int i = 0; i < nrows; i++) {
+    const int *v = &dist[(size_t)i * ncols];
+
+    int reach = none;          /* furthest right end so far */
+    for (int j = 0; j < ncols; j++) {
+      reach = std::max(reach, j + dx[v[j]]);
+      line[j] = (reach >= j);
+    }
+    reach = -none;             /* furthest left end so far */
+    for (int j = ncols - 1; j >= 0; j--) {
+      reach = std::min(reach, j - dx[v[j]]);
+      line[j] |= (reach <= j);
+    }
+
+    uint64_t *q = row(i);
+    std::fill(q, q + nwords, 0);
+    for (int j = 0; j < ncols; j++)
+      q[j >> 6] |= (uint64_t)line[j] << (j & 63);
+  }
+} // linearDilate()
@@ -0,0 +1,188 @@
+/* John Muir Institute for the Environment
+ * University of California, Davis
+ *
+ * mask.h
+ * A binary image stored one bit per pixel. Thresholding produces it,
+ * and binary morphology and connected component analysis work on whole
+ * words of it at a time. This file is part of the Salamander project.
+ *
+ * Copyright (C) 2013 Christopher Patton
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MASK_H
+#define MASK_H
+
+#include "salamander.h"
+#include "files.h"
+#include <vector>
+#include <stdint.h>
+
+
+/**
+ * Half widths of the rows of the structuring element of radius r, indexed
+ * by distance from the center row. shape is SHAPE_ELLIPSE or SHAPE_RECT.
+ */
+void halfWidths( std::vector<int> &dx, int r, int shape );
+
+/**
+ * Side of the largest square centered on the element with half widths dx.
+ * Erosion only keeps a pixel if such a square around it, clipped to the 
+ * image, is all set.
+ */
+int innerSquare( const std::vector<int> &dx );
+
+/**
+ * class Elements - structuring elements, as from halfWidths(), made once 
+ * per radius and shape and kept, so that morphology frame after frame 
+ * doesn't ask OpenCV for them again. 
+ */
+
+class Elements {
+public:
+
+  const std::vector<int> &get( int r, int shape );
+
+private:
+
+  std::vector<std::vector<int> > cache; /* by radius and shape */
+
+};
+
+
+/**
+ * class BitMask - a binary image, one bit per pixel. Pixel (i,j) is bit
+ * j % 64 of word j / 64 of row i. Bits past the last column of a row
+ * are always clear.
+ *
+ * erode() and dilate() match cv::erode() and cv::dilate() with the
+ * structuring elements used by morphology(), including the border: 
+ * pixels outside of the image don't erode the mask and don't dilate into
+ * it. There are two engines: 
+ *
+ *  ENGINE_SHIFT   ORs and ANDs whole words shifted sideways by each row 
+ *                 of the element. Cost grows with the radius, but words
+ *                 are 64 pixels wide and empty rows are skipped, so it's
+ *                 fast for small elements and sparse masks. 
+ *
+ *  ENGINE_LINEAR  Cost per pixel doesn't depend on the radius. A 
+ *                 distance transform down the columns finds the nearest
+ *                 set pixel in each column, and a running max along each
+ *                 row the union of the element rows they cover. Erosion
+ *                 is dilation of the complement. 
+ */
+
+class BitMask {
+public:
+
+  BitMask();
+  BitMask( int rows, int cols );
+
+  /* Resize, clearing every pixel. */
+  void create( int rows, int cols );
+
+  int rows() const;
+  int cols() const;
+  int words() const;            /* words per row */
+
+  uint64_t *row( int i );
+  const uint64_t *row( int i ) const;
+
+  bool get( int i, int j ) const;
+
+  /* Call sink(start, end) for each run of set pixels, start to end 
+   * inclusive, in a row of n words and cols pixels, left to right. The 
+   * ends of a run are found a word at a time rather than pixel by pixel,
+   * and a run may carry over into the next word. */
+  template <class Sink>
+  static void runs( const uint64_t *p, int n, int cols, Sink &sink );
+
+  /* No pixel is set. */
+  bool empty() const;
+
+  /* Convert to and from an 8-bit image; set pixels are 255. */
+  void toMat( cv::Mat &img ) const;
+  void fromMat( const cv::Mat &img );
+
+  /* Binary morphology with an element of radius r. shape is 
+   * SHAPE_ELLIPSE or SHAPE_RECT, engine ENGINE_SHIFT or ENGINE_LINEAR. */
+  void erode( int r, int shape=SHAPE_ELLIPSE, int engine=ENGINE_LINEAR );
+  void dilate( int r, int shape=SHAPE_ELLIPSE, int engine=ENGINE_LINEAR );
+
+private:
+
+  /* Clear the bits past the last column. */
+  void trim( uint64_t *row ) const;
+
+  /* Flip every pixel. */
+  void invert();
+
+  void shiftErode( const std::vector<int> &dx );
+  void shiftDilate( const std::vector<int> &dx );
+  void linearDilate( int r, int shape );
+
+  /* Distance along each column to the nearest set pixel, capped at 
+   * cap, into dist. */
+  void colDistance( int cap );
+
+  int nrows, ncols, nwords;
+  std::vector<uint64_t> bits;
+
+  /* Morphology scratch, kept so that a mask reused from frame to frame 
+   * doesn't allocate. */
+  Elements elements;
+  std::vector<uint64_t> scratch; /* output */
+  std::vector<uint64_t> line, tmp, inv; /* rows, for ENGINE_SHIFT */
+  std::vector<int> dist, edge;   /* distances, for ENGINE_LINEAR */
+  std::vector<int> widths; 
+  std::vector<uchar> pixels; 
+
+};
+
+template <class Sink>
+void BitMask::runs( const uint64_t *p, int n, int cols, Sink &sink )
+{
+  int start = -1;               /* start of a run carried over */
+
+  for (int k = 0; k < n; k++) {
+    uint64_t w = p[k];
+    int base = k * 64;
+
+    if (start >= 0) { /* finish the run from the last word */
+      if (w == ~(uint64_t)0)
+        continue;
+      int e = __builtin_ctzll(~w);
+      sink(start, base + e - 1);
+      start = -1;
+      w &= ~(uint64_t)0 << e;
+    }
+
+    while (w) {
+      int s = __builtin_ctzll(w);
+      uint64_t z = ~w & (~(uint64_t)0 << s);
+      if (!z) { /* runs to the end of the word */
+        start = base + s;
+        break;
+      }
+      int e = __builtin_ctzll(z);
+      sink(base + s, base + e - 1);
+      w &= ~(uint64_t)0 << e;
+    }
+  }
+  if (start >= 0)
+    sink(start, cols - 1);
+} // runs()
+
+#endif
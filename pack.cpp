@@ -0,0 +1,67 @@
+/* John Muir Institute for the Environment
+ * University of California, Davis
+ * 
+ * pack.cpp
+ * Decode a series of images once and write them to a frame store, which
+ * the other programs map into memory with -i. Useful when the same 
+ * footage is processed many times, e.g. to tune the threshold and 
+ * morphology parameters. This file is part of the Salamander project. 
+ * 
+ * Copyright (C) 2013 Christopher Patton 
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "salamander.h"
+#include "files.h"
+#include "frames.h"
+
+#include <iostream>
+#include <cstdlib>
+
+int main(int argc, const char **argv) 
+{
+
+    param_t options; 
+    options.shrink_factor = 1; 
+    options.threads = processors(); 
+    options.input[0] = '\0'; 
+    
+    if (argc == 3) {
+        options.shrink_factor = atoi(argv[2]); 
+        if (options.shrink_factor < 1) 
+            die("error: shrink factor must be at least 1"); 
+    } else if (argc != 2) { 
+        die("usage: pack store [shrink_factor] < raw"); 
+    }
+
+    /* get file names */
+    std::vector<std::string> names; 
+    filenames( names, std::cin, options.threads );
+    FileFrameSource source( names, options ); 
+    FrameBuffer frames( source, 2, options.threads ); 
+
+    try 
+    {
+        pack( argv[1], frames, options ); 
+    }
+
+    catch( cv::Exception &e )
+    {
+        std::cerr << "-- Exception ------\n" 
+                  << e.what() << std::endl
+                  << "-------------------\n";
+        return EXIT_FAILURE;
+    }
+}
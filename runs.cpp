@@ -0,0 +1,234 @@
+/* John Muir Institute for the Environment
+ * University of California, Davis
+ *
+ * runs.cpp
+ * A binary image stored as runs of set pixels, row by row. This file is 
+ * part of the Salamander project.
+ *
+ * Copyright (C) 2013 Christopher Patton
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "runs.h"
+#include <algorithm>
+#include <cstring>
+#include <assert.h>
+
+
+/**
+ * class RunMask
+ */
+
+RunMask::RunMask()
+{
+  create(0, 0);
+} // constr
+
+void RunMask::create( int rows, int cols )
+{
+  nrows = rows;
+  ncols = cols;
+  runs.clear();
+  first.assign(1, 0);
+} // create()
+
+int RunMask::rows() const
+{
+  return nrows;
+} // rows()
+
+int RunMask::cols() const
+{
+  return ncols;
+} // cols()
+
+int RunMask::size() const
+{
+  return runs.size();
+} // size()
+
+const RunMask::run_t *RunMask::begin( int i ) const
+{
+  return runs.empty() ? NULL : &runs[0] + first[i];
+} // begin()
+
+const RunMask::run_t *RunMask::end( int i ) const
+{
+  return runs.empty() ? NULL : &runs[0] + first[i+1];
+} // end()
+
+bool RunMask::empty() const
+{
+  return runs.empty();
+} // empty()
+
+uint64_t *RunMask::line()
+{
+  words.resize((ncols + 63) / 64);
+  return &words[0];
+} // line()
+
+void RunMask::operator() ( int start, int end )
+{
+  run_t r = { start, end };
+  runs.push_back(r);
+} // operator()
+
+void RunMask::append( const uint64_t *bits )
+{
+  assert(first.size() <= nrows);
+  BitMask::runs(bits, (ncols + 63) / 64, ncols, *this);
+  first.push_back(runs.size());
+} // append()
+
+void RunMask::fromBits( const BitMask &mask )
+{
+  create(mask.rows(), mask.cols());
+  for (int i = 0; i < nrows; i++)
+    append(mask.row(i));
+} // fromBits()
+
+void RunMask::toMat( cv::Mat &img ) const
+{
+  img.create(nrows, ncols, CV_8UC1);
+  for (int i = 0; i < nrows; i++) {
+    uchar *p = img.ptr<uchar>(i);
+    memset(p, 0, ncols);
+    for (const run_t *q = begin(i); q != end(i); q++)
+      memset(p + q->start, 255, q->end - q->start + 1);
+  }
+} // toMat()
+
+bool RunMask::before( const cell_t &a, const cell_t &b )
+{
+  return a.start < b.start;
+} // before()
+
+void RunMask::dilate( int r, int shape )
+/* Each run of row s, widened by the half width of row dy of the element, 
+ * lands on rows s-dy and s+dy. Sort what lands on each row by row, then 
+ * by start, and merge runs that overlap or touch. Pixels outside of the 
+ * image are clear, so runs are cut off at the ends of a row. */
+{
+  if (r <= 0 || nrows == 0)
+    return;
+  const std::vector<int> &dx = elements.get(r, shape);
+
+  cells.clear();
+  for (int s = 0; s < nrows; s++) {
+    if (first[s] == first[s+1])
+      continue;
+    for (int i = std::max(0, s - r); i <= std::min(nrows - 1, s + r); i++) {
+      int w = dx[std::abs(i - s)];
+      for (const run_t *q = begin(s); q != end(s); q++) {
+        cell_t c = { i, std::max(0, q->start - w), 
+                        std::min(ncols - 1, q->end + w) };
+        cells.push_back(c);
+      }
+    }
+  }
+
+  /* counts[i] is where row i starts in sorted, then where it ends */
+  counts.assign(nrows + 1, 0);
+  for (int k = 0; k < cells.size(); k++)
+    counts[cells[k].row + 1]++;
+  for (int i = 0; i < nrows; i++)
+    counts[i+1] += counts[i];
+  sorted.resize(cells.size());
+  for (int k = 0; k < cells.size(); k++)
+    sorted[counts[cells[k].row]++] = cells[k];
+
+  out.clear();
+  outFirst.assign(1, 0);
+  for (int i = 0, lo = 0; i < nrows; lo = counts[i++]) {
+    int hi = counts[i];
+    if (lo < hi) {
+      std::sort(sorted.begin() + lo, sorted.begin() + hi, before);
+      run_t cur = { sorted[lo].start, sorted[lo].end };
+      for (int k = lo + 1; k < hi; k++) {
+        if (sorted[k].start <= cur.end + 1)
+          cur.end = std::max(cur.end, sorted[k].end);
+        else {
+          out.push_back(cur);
+          cur.start = sorted[k].start;
+          cur.end = sorted[k].end;
+        }
+      }
+      out.push_back(cur);
+    }
+    outFirst.push_back(out.size());
+  }
+
+  runs.swap(out);
+  first.swap(outFirst);
+} // dilate()
+
+void RunMask::intersect( std::vector<run_t> &a, int s, int w )
+/* a = a & (row s, each run shrunk by w). Pixels outside of the image are
+ * set, so a run that reaches the end of the row isn't shrunk at that end.*/
+{
+  b.clear();
+  int p = 0;
+  const run_t *q = begin(s), *e = end(s);
+  while (p < a.size() && q != e) {
+    int from = q->start == 0 ? 0 : q->start + w, 
+        to = q->end == ncols - 1 ? ncols - 1 : q->end - w;
+    if (from > to) {
+      q++;
+      continue;
+    }
+    int lo = std::max(a[p].start, from), hi = std::min(a[p].end, to);
+    if (lo <= hi) {
+      run_t c = { lo, hi };
+      b.push_back(c);
+    }
+    if (a[p].end < to)
+      p++;
+    else
+      q++;
+  }
+  a.swap(b);
+} // intersect()
+
+void RunMask::erode( int r, int shape )
+/* Row i of the output is the intersection of rows i-dy and i+dy, shrunk by
+ * the half width of row dy of the element, for each dy. Rows outside of 
+ * the image are skipped. A row without runs can't survive, and each stops
+ * as soon as its intersection is empty. */
+{
+  if (r <= 0 || nrows == 0)
+    return;
+  const std::vector<int> &dx = elements.get(r, shape);
+  run_t all = { 0, ncols - 1 };
+
+  out.clear();
+  outFirst.assign(1, 0);
+  for (int i = 0; i < nrows; i++) {
+    if (first[i] < first[i+1]) {
+      a.assign(1, all);
+      for (int dy = 0; dy <= r && !a.empty(); dy++) {
+        if (i - dy >= 0)
+          intersect(a, i - dy, dx[dy]);
+        if (dy > 0 && i + dy < nrows && !a.empty())
+          intersect(a, i + dy, dx[dy]);
+      }
+      out.insert(out.end(), a.begin(), a.end());
+    }
+    outFirst.push_back(out.size());
+  }
+
+  runs.swap(out);
+  first.swap(outFirst);
+} // erode()
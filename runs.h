@@ -0,0 +1,115 @@
+/* John Muir Institute for the Environment
+ * University of California, Davis
+ *
+ * runs.h
+ * A binary image stored as runs of set pixels, row by row. Masks of 
+ * wildlife footage are mostly empty, so morphology and connected component
+ * analysis on runs do work in proportion to the foreground rather than to
+ * the frame. This file is part of the Salamander project.
+ *
+ * Copyright (C) 2013 Christopher Patton
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RUNS_H
+#define RUNS_H
+
+#include "salamander.h"
+#include "mask.h"
+#include <vector>
+#include <stdint.h>
+
+
+/**
+ * class RunMask - a binary image as a list of runs of set pixels for each
+ * row. Runs of a row are in order, and at least one clear pixel apart. 
+ * The mask is built a row at a time, top to bottom. 
+ *
+ * erode() and dilate() give the same result as BitMask's, and so as 
+ * cv::erode() and cv::dilate(). Dilation widens each run by the half 
+ * width of each row of the element and merges what lands on the same row.
+ * Erosion of a row is the intersection of the rows around it, each run 
+ * shrunk by the half width of the element's row; a row without runs stops
+ * it early. Either way, the cost is the number of runs times the height 
+ * of the element. 
+ */
+
+class RunMask {
+public:
+
+  struct run_t {
+    int start, end;             /* pixels start to end inclusive */
+  };
+
+  RunMask();
+
+  /* Resize and clear, ready for rows to be appended. */
+  void create( int rows, int cols );
+
+  int rows() const;
+  int cols() const;
+  int size() const;             /* number of runs */
+
+  /* Runs of row i. */
+  const run_t *begin( int i ) const;
+  const run_t *end( int i ) const;
+
+  /* No pixel is set. */
+  bool empty() const;
+
+  /* A row of words, as in a BitMask row, for filling and passing to 
+   * append(). */
+  uint64_t *line();
+
+  /* Append the next row from its bits, as in a BitMask row. */
+  void append( const uint64_t *bits );
+
+  /* Convert to and from other masks. */
+  void fromBits( const BitMask &mask );
+  void toMat( cv::Mat &img ) const;
+
+  /* Binary morphology with an element of radius r. */
+  void erode( int r, int shape=SHAPE_ELLIPSE );
+  void dilate( int r, int shape=SHAPE_ELLIPSE );
+
+  /* Appends runs, for BitMask::runs(). */
+  void operator() ( int start, int end );
+
+private:
+
+  /* A run headed for row i of the output. */
+  struct cell_t {
+    int row, start, end;
+  };
+
+  static bool before( const cell_t &a, const cell_t &b );
+
+  /* a = a & (row s, each run shrunk by w), using b. */
+  void intersect( std::vector<run_t> &a, int s, int w );
+
+  int nrows, ncols;
+  std::vector<run_t> runs;
+  std::vector<int> first;       /* first run of each row, and the end */
+
+  /* Morphology scratch, kept from frame to frame. */
+  Elements elements;
+  std::vector<uint64_t> words;  /* line() */
+  std::vector<run_t> out, a, b;
+  std::vector<int> outFirst, counts;
+  std::vector<cell_t> cells, sorted;
+
+};
+
+#endif
@@ -24,10 +24,26 @@
 #include "salamander.h"
 #include "blobs.h"
 #include "files.h"
+#include "frames.h"
+#include "mask.h"
+#include "runs.h"
 #include "opencv2/imgproc/imgproc.hpp"
 #include <algorithm> // sort()
 #include <cstring>
 #include <cstdlib>
+#include <cstdio>
+#include <csetjmp>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+extern "C" {
+#include <jpeglib.h>
+}
 
 void delta( cv::Mat &delta,
             const char *in1, 
@@ -37,20 +53,16 @@ void delta( cv::Mat &delta,
  * binary morphology filter. */
 {
 
-  /* Read files from disk */ 
-  delta = cv::imread( in1, CV_LOAD_IMAGE_GRAYSCALE ); 
-  cv::Mat &A = delta, B = cv::imread( in2, CV_LOAD_IMAGE_GRAYSCALE ); 
-
-  /* Shrink files by factor */ 
-  cv::Size size(delta.cols/options.shrink_factor, delta.rows/options.shrink_factor); 
-  cv::resize(A, A, size);
-  cv::resize(B, B, size);
+  /* Read files from disk, shrunk by factor */ 
+  cv::Mat B; 
+  read( delta, in1, options ); 
+  read( B, in2, options ); 
 
   /* Pixel-wise absolute difference */  
-  cv::absdiff(A, B, delta); 
-
   if (thresh)
-    threshold(delta, options); 
+    threshold(delta, delta, B, options); 
+  else 
+    cv::absdiff(delta, B, delta); 
   
 } // original delta() 
 
@@ -63,27 +75,112 @@ void threshold( cv::Mat &img, const char *in, const param_t &options )
 } // threshold()
 
 
+struct jpeg_error_t {
+  struct jpeg_error_mgr pub; 
+  jmp_buf jump; 
+}; 
+
+static void jpeg_error_exit( j_common_ptr cinfo ) 
+{
+  longjmp(((jpeg_error_t *)cinfo->err)->jump, 1); 
+} // jpeg_error_exit()
+
+static bool readReduced( cv::Mat &img, const char *in, int factor ) 
+/* Decode a JPEG file to grayscale at 1/factor scale. libjpeg does the 
+ * scaling in the IDCT, so the full resolution image is never produced. 
+ * It rounds the scaled dimensions up; crop to the size cv::resize() would 
+ * give. Return false if the file can't be decoded this way. */ 
+{
+  FILE *fp = fopen(in, "rb"); 
+  if (!fp) 
+    return false; 
+
+  struct jpeg_decompress_struct cinfo; 
+  jpeg_error_t err; 
+  cinfo.err = jpeg_std_error(&err.pub); 
+  err.pub.error_exit = jpeg_error_exit; 
+  
+  if (setjmp(err.jump)) { /* not a JPEG, or corrupt */ 
+    jpeg_destroy_decompress(&cinfo); 
+    fclose(fp); 
+    return false; 
+  }
+
+  jpeg_create_decompress(&cinfo); 
+  jpeg_stdio_src(&cinfo, fp); 
+  jpeg_read_header(&cinfo, TRUE); 
+
+  int rows = cinfo.image_height / factor, 
+      cols = cinfo.image_width / factor; 
+  cinfo.out_color_space = JCS_GRAYSCALE; 
+  cinfo.scale_num = 1; 
+  cinfo.scale_denom = factor; 
+  jpeg_start_decompress(&cinfo); 
+
+  img.create(rows, cols, CV_8UC1); 
+  JSAMPARRAY line = (*cinfo.mem->alloc_sarray)((j_common_ptr)&cinfo, 
+                                  JPOOL_IMAGE, cinfo.output_width, 1); 
+  while (cinfo.output_scanline < cinfo.output_height) {
+    int i = cinfo.output_scanline; 
+    jpeg_read_scanlines(&cinfo, line, 1); 
+    if (i < rows) 
+      memcpy(img.ptr<uchar>(i), line[0], cols); 
+  }
+
+  jpeg_finish_decompress(&cinfo); 
+  jpeg_destroy_decompress(&cinfo); 
+  fclose(fp); 
+  return true; 
+} // readReduced()
+
 void read( cv::Mat &img, const char *in, const param_t &options ) 
-/* Read and convert an image for the processing pipeline. */
+/* Read and convert an image for the processing pipeline. For shrink 
+ * factors the JPEG decoder supports, decode directly at the reduced 
+ * size. */
 {
+  switch (options.shrink_factor) {
+    case 2: case 4: case 8: 
+      if (readReduced( img, in, options.shrink_factor ))
+        return; 
+  }
+
   img = cv::imread( in, CV_LOAD_IMAGE_GRAYSCALE ); 
+  if (img.empty()) 
+    CV_Error(CV_StsError, std::string("can't decode frame ") + in); 
 
   /* Shrink file by factor */ 
-  cv::Size size(img.cols/options.shrink_factor, img.rows/options.shrink_factor); 
-  cv::resize(img, img, size);
+  if (options.shrink_factor > 1) {
+    cv::Size size(img.cols/options.shrink_factor, img.rows/options.shrink_factor); 
+    cv::resize(img, img, size);
+  }
 } // read() 
 
 
+void prepare( cv::Mat &img, const cv::Mat &frame, const param_t &options ) 
+/* Convert a decoded color frame for the processing pipeline. */ 
+{
+  if (frame.channels() == 1) 
+    frame.copyTo(img); 
+  else
+    cv::cvtColor(frame, img, CV_BGR2GRAY); 
+
+  /* Shrink frame by factor */ 
+  if (options.shrink_factor > 1) {
+    cv::Size size(img.cols/options.shrink_factor, img.rows/options.shrink_factor); 
+    cv::resize(img, img, size);
+  }
+} // prepare() 
+
+
 void delta( cv::Mat &img1, const cv::Mat &img2, 
             bool thresh, const param_t &options )
 /* Subtract a video frame from prevoius in stream and apply binary threshold. */
 {
   /* Pixel-wise absolute difference */  
-  cv::absdiff(img1, img2, img1); 
-
-  if (thresh) {
-     threshold(img1, options); /* TODO */ 
-  }
+  if (thresh)
+    threshold(img1, img1, img2, options); 
+  else 
+    cv::absdiff(img1, img2, img1); 
 } // delata() 
 
 
@@ -101,6 +198,28 @@ void delta( cv::Mat &img1, const cv::Mat &img2, const Blob &blob )
 } // delta() 
 
 
+void delta( cv::Mat &img, FrameBuffer &frames, int i, int j, 
+            bool thresh, const param_t &options )
+/* Subtract frame j from frame i. Both are taken from the frame buffer, so a 
+ * sliding delta over the stream decodes each frame only once. The buffered 
+ * frames are left intact. */ 
+{
+  /* Pixel-wise absolute difference */  
+  if (thresh)
+    threshold(img, frames[i], frames[j], options); 
+  else 
+    cv::absdiff(frames[i], frames[j], img); 
+
+} // delta() 
+
+void delta( BitMask &mask, FrameBuffer &frames, int i, int j, 
+            const param_t &options )
+/* Thresholded delta of frames i and j, as a bit mask. */ 
+{
+  threshold(mask, frames[i], frames[j], options); 
+} // delta() 
+
+
 void threshold( cv::Mat &img, const param_t &options )
 /* Apply binary threshold filter to delta. */  
 {
@@ -127,6 +246,266 @@ void threshold( cv::Mat &img, const param_t &options )
   }
 } // threshold() 
 
+
+/* The fused delta and threshold kernels. With unsigned saturation, 
+ * |a - b| is (a -sat b) | (b -sat a), and d is in range [low, high] iff 
+ * max(d, low) == d and min(d, high) == d. Each lane of the result is 0xff
+ * if the pixel is in range. */ 
+
+#ifdef __AVX2__
+static inline __m256i inRange( const uchar *a, const uchar *b, 
+                               __m256i low, __m256i high ) 
+{
+  __m256i x = _mm256_loadu_si256((const __m256i *)a), 
+          y = _mm256_loadu_si256((const __m256i *)b); 
+  __m256i d = _mm256_or_si256(_mm256_subs_epu8(x, y), _mm256_subs_epu8(y, x)); 
+  return _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(d, low), d), 
+                          _mm256_cmpeq_epi8(_mm256_min_epu8(d, high), d)); 
+} // inRange()
+#endif
+
+#ifdef __SSE2__
+static inline __m128i inRange( const uchar *a, const uchar *b, 
+                               __m128i low, __m128i high ) 
+{
+  __m128i x = _mm_loadu_si128((const __m128i *)a), 
+          y = _mm_loadu_si128((const __m128i *)b); 
+  __m128i d = _mm_or_si128(_mm_subs_epu8(x, y), _mm_subs_epu8(y, x)); 
+  return _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(d, low), d), 
+                       _mm_cmpeq_epi8(_mm_min_epu8(d, high), d)); 
+} // inRange()
+#endif
+
+static inline bool inRange( uchar a, uchar b, int low, int high ) 
+{
+  int d = a > b ? a - b : b - a; 
+  return low <= d && d <= high; 
+} // inRange()
+
+static void threshold( uchar *mask, const uchar *a, const uchar *b, int n, 
+                       int low, int high ) 
+/* mask[k] = 255 if low <= |a[k] - b[k]| <= high, else 0. mask may be a. */ 
+{
+  int k = 0; 
+
+#ifdef __AVX2__
+  const __m256i lo32 = _mm256_set1_epi8((char)low), 
+                hi32 = _mm256_set1_epi8((char)high); 
+  for (; k + 32 <= n; k += 32) 
+    _mm256_storeu_si256((__m256i *)(mask + k), 
+                        inRange(a + k, b + k, lo32, hi32)); 
+#endif
+
+#ifdef __SSE2__
+  const __m128i lo16 = _mm_set1_epi8((char)low), 
+                hi16 = _mm_set1_epi8((char)high); 
+  for (; k + 16 <= n; k += 16) 
+    _mm_storeu_si128((__m128i *)(mask + k), 
+                     inRange(a + k, b + k, lo16, hi16)); 
+#endif
+
+  for (; k < n; k++) 
+    mask[k] = inRange(a[k], b[k], low, high) ? 255 : 0; 
+} // threshold() 
+
+static void threshold( uint64_t *mask, const uchar *a, const uchar *b, 
+                       int n, int low, int high ) 
+/* Bit k of the row of words is set if low <= |a[k] - b[k]| <= high. The 
+ * lane masks are packed into bits with movemask, 64 pixels at a time. */ 
+{
+  int k = 0; 
+
+#if defined(__AVX2__)
+  const __m256i lo32 = _mm256_set1_epi8((char)low), 
+                hi32 = _mm256_set1_epi8((char)high); 
+  for (; k + 64 <= n; k += 64) 
+    mask[k >> 6] = 
+      (uint64_t)(uint32_t)_mm256_movemask_epi8(
+                            inRange(a + k, b + k, lo32, hi32)) | 
+      (uint64_t)(uint32_t)_mm256_movemask_epi8(
+                            inRange(a + k + 32, b + k + 32, lo32, hi32)) << 32; 
+#elif defined(__SSE2__)
+  const __m128i lo16 = _mm_set1_epi8((char)low), 
+                hi16 = _mm_set1_epi8((char)high); 
+  for (; k + 64 <= n; k += 64) {
+    uint64_t w = 0; 
+    for (int l = 0; l < 64; l += 16) 
+      w |= (uint64_t)(_mm_movemask_epi8(
+                        inRange(a + k + l, b + k + l, lo16, hi16)) & 0xffff) << l; 
+    mask[k >> 6] = w; 
+  }
+#endif
+
+  for (; k < n; k += 64) {
+    uint64_t w = 0; 
+    for (int l = 0; l < 64 && k + l < n; l++) 
+      if (inRange(a[k + l], b[k + l], low, high)) 
+        w |= (uint64_t)1 << l; 
+    mask[k >> 6] = w; 
+  }
+} // threshold() 
+
+static bool range( int &low, int &high, const param_t &options ) 
+/* The range is [low, high); make it [low, high-1] within a byte. Return 
+ * false if it's empty. */ 
+{
+  low = std::max(options.low, 0); 
+  high = std::min(options.high - 1, 255); 
+  return low <= high; 
+} // range()
+
+void threshold( cv::Mat &mask, const cv::Mat &A, const cv::Mat &B, 
+                const param_t &options ) 
+/* Fused delta and binary threshold. Read both frames and write the mask 
+ * in one pass, without an intermediate difference image. mask may be A. */ 
+{
+  CV_Assert(A.type() == CV_8UC1 && B.type() == CV_8UC1 && A.size() == B.size()); 
+  mask.create(A.size(), CV_8UC1); 
+
+  int low, high; 
+  if (!range(low, high, options)) { 
+    mask = cv::Scalar(0); 
+    return; 
+  }
+
+  int nrows = A.rows, ncols = A.cols; 
+  if (A.isContinuous() && B.isContinuous() && mask.isContinuous()) {
+    ncols *= nrows; 
+    nrows = 1; 
+  }
+
+  for (int i = 0; i < nrows; i++) 
+    threshold(mask.ptr<uchar>(i), A.ptr<uchar>(i), B.ptr<uchar>(i), 
+              ncols, low, high); 
+} // threshold() 
+
+void threshold( BitMask &mask, const cv::Mat &A, const cv::Mat &B, 
+                const param_t &options ) 
+/* Fused delta and binary threshold into a bit mask. */ 
+{
+  CV_Assert(A.type() == CV_8UC1 && B.type() == CV_8UC1 && A.size() == B.size()); 
+  if (mask.rows() != A.rows || mask.cols() != A.cols) 
+    mask.create(A.rows, A.cols); 
+
+  int low, high; 
+  if (!range(low, high, options)) { 
+    mask.create(A.rows, A.cols); 
+    return; 
+  }
+
+  for (int i = 0; i < A.rows; i++) 
+    threshold(mask.row(i), A.ptr<uchar>(i), B.ptr<uchar>(i), 
+              A.cols, low, high); 
+} // threshold() 
+
+void threshold( RunMask &mask, const cv::Mat &A, const cv::Mat &B, 
+                const param_t &options ) 
+/* Fused delta and binary threshold into runs, a row of bits at a time. */ 
+{
+  CV_Assert(A.type() == CV_8UC1 && B.type() == CV_8UC1 && A.size() == B.size()); 
+  mask.create(A.rows, A.cols); 
+
+  int low, high; 
+  if (!range(low, high, options)) { 
+    memset(mask.line(), 0, (A.cols + 63) / 64 * sizeof(uint64_t)); 
+    for (int i = 0; i < A.rows; i++) 
+      mask.append(mask.line()); 
+    return; 
+  }
+
+  for (int i = 0; i < A.rows; i++) {
+    threshold(mask.line(), A.ptr<uchar>(i), B.ptr<uchar>(i), 
+              A.cols, low, high); 
+    mask.append(mask.line()); 
+  }
+} // threshold() 
+
+bool sample( const cv::Mat &A, const cv::Mat &B, int stride, 
+             const param_t &options ) 
+/* Threshold the delta only on a grid of every stride-th row and column, 
+ * plus the last row and column, and return true if any pixel of it is in
+ * range. If none is, no pixel of the full mask survives erosion by an 
+ * element holding a square of side stride: around any pixel that did, 
+ * the square clipped to the image spans stride rows and columns or 
+ * reaches an edge, so it would have a grid pixel in it. */ 
+{
+  CV_Assert(A.type() == CV_8UC1 && B.type() == CV_8UC1 && A.size() == B.size()); 
+  int low, high; 
+  if (!range(low, high, options) || A.empty()) 
+    return false; 
+
+  for (int i = 0; i < A.rows; i += stride) {
+    const uchar *a = A.ptr<uchar>(i), *b = B.ptr<uchar>(i); 
+    for (int j = 0; j < A.cols; j += stride) 
+      if (inRange(a[j], b[j], low, high)) 
+        return true; 
+    if (inRange(a[A.cols-1], b[A.cols-1], low, high)) 
+      return true; 
+    if (i < A.rows - 1 && i + stride > A.rows - 1) 
+      i = A.rows - 1 - stride; /* the last row is next */ 
+  }
+  return false; 
+} // sample() 
+
+static bool reaches( const uchar *a, const uchar *b, int n, int low ) 
+/* Some |a[k] - b[k]| is at least low. */ 
+{
+  int k = 0; 
+
+#if defined(__SSE2__)
+  __m128i m = _mm_setzero_si128(); 
+  for (; k + 16 <= n; k += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(a + k)), 
+            y = _mm_loadu_si128((const __m128i *)(b + k)); 
+    m = _mm_max_epu8(m, _mm_or_si128(_mm_subs_epu8(x, y), 
+                                     _mm_subs_epu8(y, x))); 
+  }
+  const __m128i lo16 = _mm_set1_epi8((char)low); 
+  if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(m, lo16), m))) 
+    return true; 
+#endif
+
+  for (; k < n; k++) 
+    if ((a[k] > b[k] ? a[k] - b[k] : b[k] - a[k]) >= low) 
+      return true; 
+  return false; 
+} // reaches()
+
+cv::Rect changed( const cv::Mat &A, const cv::Mat &B, int tile, 
+                  const param_t &options ) 
+/* Bounding box of the tiles, tile x tile pixels, whose largest absolute 
+ * difference reaches the low end of the threshold range. Outside of it,
+ * the thresholded delta is clear. (The sum of absolute differences of a
+ * tile would grow with sensor noise alone; its largest doesn't.) Tiles 
+ * already inside the box found so far aren't looked at. */ 
+{
+  CV_Assert(A.type() == CV_8UC1 && B.type() == CV_8UC1 && A.size() == B.size()); 
+  int low, high; 
+  if (!range(low, high, options)) 
+    return cv::Rect(); 
+
+  int left = A.cols, right = 0, top = A.rows, bottom = 0; 
+  for (int i = 0; i < A.rows; i += tile) {
+    int h = std::min(tile, A.rows - i); 
+    for (int j = 0; j < A.cols; j += tile) {
+      int w = std::min(tile, A.cols - j); 
+      if (left <= j && j + w <= right && i + h <= bottom) 
+        continue; 
+      for (int l = i; l < i + h; l++) 
+        if (reaches(A.ptr<uchar>(l) + j, B.ptr<uchar>(l) + j, w, low)) {
+          left = std::min(left, j); 
+          right = std::max(right, j + w); 
+          top = std::min(top, i); 
+          bottom = i + h; 
+          break; 
+        }
+    }
+  }
+  if (right == 0) 
+    return cv::Rect(); 
+  return cv::Rect(left, top, right - left, bottom - top); 
+} // changed() 
+
 void morphology( cv::Mat &img, const param_t &options )
 /* Apply binary morphology filter to delta. Erode away weak blobs and dilate 
  * the remaining. */
@@ -134,7 +513,8 @@ void morphology( cv::Mat &img, const param_t &options )
 
   /* Morphology */
 
-  int structuring_type = cv::MORPH_ELLIPSE; /* MORPH_{RECT,CROSS,ELLIPSE} */ 
+  int structuring_type = /* MORPH_{RECT,CROSS,ELLIPSE} */ 
+    (options.shape == SHAPE_RECT ? cv::MORPH_RECT : cv::MORPH_ELLIPSE); 
 
   cv::Mat erosion_element = cv::getStructuringElement( structuring_type,
                              cv::Size( 2*options.erode + 1, 2*options.erode+1 ),
@@ -149,24 +529,73 @@ void morphology( cv::Mat &img, const param_t &options )
 
 } // threshold() 
 
-int getBlobs( const cv::Mat &img, std::vector<Blob> &blobs )
+bool morphology( BitMask &mask, const param_t &options )
+/* Binary morphology on a bit mask, with the same elements as above. Dilation
+ * can't bring back a mask that erosion emptied, so it's skipped then. 
+ * Return false if nothing is left. */ 
+{
+  if (mask.empty()) 
+    return false; 
+  mask.erode( options.erode, options.shape, options.engine ); 
+  if (mask.empty()) 
+    return false; 
+  mask.dilate( options.dilate, options.shape, options.engine ); 
+  return true; 
+} // morphology() 
+
+bool morphology( RunMask &mask, const param_t &options )
+/* Binary morphology on runs, with the same elements as above. */ 
+{
+  if (mask.empty()) 
+    return false; 
+  mask.erode( options.erode, options.shape ); 
+  if (mask.empty()) 
+    return false; 
+  mask.dilate( options.dilate, options.shape ); 
+  return true; 
+} // morphology() 
+
+int getBlobs( const cv::Mat &img, std::vector<Blob> &blobs, int min_volume,
+              int threads )
 /* Perform connected component analysis and return a set of features for each
- * blob in frame. Expect binary threshold-filtered image. */ 
+ * blob in frame. Expect binary threshold-filtered image. Blobs of fewer than
+ * min_volume pixels are left out. A large image is labeled in strips on up 
+ * to threads threads. The labeler is local, so this is safe to call from 
+ * any thread; a Workspace keeps its own from frame to frame. */ 
 {
+  ConnectedComponents cc; 
+  cc.label( img, min_volume, threads ); 
   blobs.clear(); 
-  ConnectedComponents cc( img ); 
   for (int i = 0; i < cc.size(); i++) 
     blobs.push_back(cc[i]);
   return blobs.size();
 } // getBlobs() 
 
-void drawBoundingBox( const char *in, const char *out, const Blob &blob )
+int getBlobs( const BitMask &mask, std::vector<Blob> &blobs, int min_volume,
+              int threads )
+/* Connected component analysis of a bit mask. */ 
+{
+  MaskComponents cc; 
+  cc.label( mask, min_volume, threads ); 
+  blobs.clear(); 
+  for (int i = 0; i < cc.size(); i++) 
+    blobs.push_back(cc[i]);
+  return blobs.size();
+} // getBlobs() 
+
+bool drawBoundingBox( const char *in, const char *out, const Blob &blob )
 /* Draw a bounding box on a JPEG image, as specified by a Blob object. Output
  * to a new file. */ 
 {
   cv::Mat img = cv::imread( in ); 
+  return drawBoundingBox( img, out, blob ); 
+} // drawBoundingBox() 
+
+bool drawBoundingBox( cv::Mat &img, const char *out, const Blob &blob )
+/* Draw a bounding box on a decoded frame and output it. */ 
+{
   cv::rectangle( img, cv::Point(blob[0],blob[2]), 
                       cv::Point(blob[1],blob[3]), 
                       cv::Scalar(128,64,0), 2 );
-  cv::imwrite( out, img ); 
-} // drawBoundingBox() 
+  return cv::imwrite( out, img ); 
+} // drawBoundingBox()  
@@ -37,6 +37,9 @@
 
 /* Forward declarations */ 
 class Blob; 
+class FrameBuffer; 
+class BitMask; 
+class RunMask; 
 struct param_t; 
  
 void delta( cv::Mat&,
@@ -48,17 +51,50 @@ void threshold( cv::Mat&, const char *, const param_t &options );
 
 void read( cv::Mat&, const char *, const param_t &options ); 
 
+void prepare( cv::Mat&, const cv::Mat &frame, const param_t &options ); 
+
 void delta( cv::Mat&, const cv::Mat&, 
             bool thresh, const param_t &options );
 
 void delta( cv::Mat&, const cv::Mat&, const Blob& ); 
+
+void delta( cv::Mat&, FrameBuffer&, int i, int j, 
+            bool thresh, const param_t &options );
+
+void delta( BitMask&, FrameBuffer&, int i, int j, const param_t &options );
                           
 void threshold( cv::Mat&, const param_t &options ); 
 
+void threshold( cv::Mat &mask, const cv::Mat&, const cv::Mat&, 
+                const param_t &options ); 
+
+void threshold( BitMask &mask, const cv::Mat&, const cv::Mat&, 
+                const param_t &options ); 
+
+void threshold( RunMask &mask, const cv::Mat&, const cv::Mat&, 
+                const param_t &options ); 
+
 void morphology( cv::Mat&, const param_t &options ); 
 
-int getBlobs( const cv::Mat &, std::vector<Blob> &blobs ); 
+bool sample( const cv::Mat&, const cv::Mat&, int stride, 
+             const param_t &options ); 
+
+cv::Rect changed( const cv::Mat&, const cv::Mat&, int tile, 
+                  const param_t &options ); 
+
+bool morphology( BitMask&, const param_t &options ); 
+
+bool morphology( RunMask&, const param_t &options ); 
+
+int getBlobs( const cv::Mat &, std::vector<Blob> &blobs, int min_volume=0,
+              int threads=1 ); 
+
+int getBlobs( const BitMask &, std::vector<Blob> &blobs, int min_volume=0,
+              int threads=1 ); 
+
+/* Return false if the image can't be written. */ 
+bool drawBoundingBox( const char *in, const char *out, const Blob &blob );
 
-void drawBoundingBox( const char *in, const char *out, const Blob &blob );
+bool drawBoundingBox( cv::Mat &img, const char *out, const Blob &blob );
 
 #endif
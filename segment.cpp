@@ -30,8 +30,14 @@
 #include "salamander.h"
 #include "chunks.h"
 #include "files.h"
+#include "frames.h"
+#include "writer.h"
+#include "workspace.h"
+#include "gaps.h"
 #include <iostream>
 #include <cstdlib>
+#include <algorithm>
+#include <csignal>
 #include <assert.h>
 using namespace std;
 
@@ -51,7 +57,34 @@ order. Eg. ls *.jpg | detect <options>\n\
   -t L H     Binary threshold range <L, H>. 0 < L < H < 255.\n\n\
   -m E D     Binary morphology erode and dilate factors. Eg., 2 20.\n\
              Threshold range defaults to <40, 60> if -t is unspecified.\n\n\
+  --shape S  Structuring element, ellipse (default) or rect.\n\n\
+  --morph M  Morphology implementation: linear (default), whose cost\n\
+             doesn't grow with the factors; shift, which is faster\n\
+             for small ones; or runs, whose cost grows with the\n\
+             foreground, for mostly empty masks.\n\n\
+  --cascade  Sample the delta on a coarse grid first, and only threshold\n\
+             all of it if the sample could hold a blob. Finds the same\n\
+             blobs, faster on idle footage with an erode factor of 2\n\
+             or more.\n\n\
+  --tiles    Only threshold, clean up and label the part of the delta\n\
+             around 32x32 tiles that changed. Finds the same blobs.\n\n\
+  --roi N    While tracking, only process a window around the target,\n\
+             and the whole frame every N frames to catch new ones.\n\
+             Defaults to 0, the whole frame every frame.\n\n\
   -s N       Image shrink factor. Defaults to 1 (don't shrink)\n\n\
+  -i file    Read frames from a video file (AVI, MJPEG, MP4, ...)\n\
+             instead of a list of JPEG images.\n\n\
+  -x file    Index of JPEG images. If it exists, it's read instead of\n\
+             standard input; otherwise it's saved for the next run.\n\n\
+  --follow dir  Process JPEG images as they are dropped in a directory,\n\
+             until interrupted.\n\n\
+  -j N       Frame decoding, gap checking and output threads, 0 to do\n\
+             everything on the main thread. Defaults to the number of\n\
+             processors.\n\n\
+  -w N       Annotated frames waiting to be written before more are\n\
+             dropped, 0 to wait on each one. Defaults to 64.\n\n\
+  -v N       Ignore blobs of fewer than N pixels (after shrinking).\n\
+             Defaults to 0.\n\n\
   -f name    File prefix for output files.\n\n\
   -h         Display this message.";
 
@@ -59,146 +92,118 @@ param_t options; // threshold/morphology options
 char outname [256]; 
 int  outname_index = 0; 
 
-bool delta( string &img1, string &img2, cv::Mat &image, bool writeout=false ) 
+bool delta( Workspace &ws, FrameBuffer &frames, int i, bool writeout=false ) 
 {
-  cv::Mat im;
-  static vector<Blob> blobs;
-
-  delta(im, img1.c_str(), img2.c_str(), true, options );
-  morphology( im, options  );
-  getBlobs( im, blobs );
+  ws.detect( frames[i], frames[i-1], options );
 
   if (writeout) {
     sprintf(outname, "%s%d.jpg", options.prefix, outname_index++);
-    cv::imwrite( outname, im ); 
+    if (!cv::imwrite( outname, ws.image() )) 
+      cerr << "can't write " << outname << endl; 
   }
 
   /* if there are blobs in the delta image, a target is in the frame */
-  if( blobs.size() > 0 ) {
-    image = im.clone(); // save a copy of the delta image as a side-effect
-    return true;
-  }
-
-  else return false;
+  return ws.blobs.size() > 0; 
 }
 
 
-bool targetPersistsOverGap( vector<string> &names, Chunks &chunks, int i, int j, const Blob &region )
-{ 
-  static cv::Mat A, B; 
-  static vector<Blob> blobs;
-
-  j = (i+j)/2; 
-  
-  for (Chunk *chunk = chunks.end(); chunk != NULL; chunk = chunks.prev()) {
-    const vector<Track> &tracks = chunk->getTracks();  
-    for (i = tracks.size() - 1; i >= 0 && tracks[i].blob.Intersects(region); --i) 
-      ; 
-    if (i >= 0) {
-      i = tracks[i].index; 
-      break; 
-    }
-    else if (chunk->gapKnown()) {
-      i = chunk->getStartIndex() - 1; 
-      break;        
-    }
-    else i = 0; 
+bool track( Workspace &ws, FrameBuffer &frames, int i, int left, 
+            const Chunk *chunk ) 
+/* delta() for frame i of a chunk that started at left. With --roi N, 
+ * only a window is looked at, except every N frames: it covers where the
+ * target was, which shows up in the delta as it leaves, and where it's 
+ * predicted to be, with room for half its size of error and for 
+ * morphology to reach. The whole frame is looked at too if the window 
+ * comes up empty or can't vouch for its blobs. */ 
+{
+  if (options.roi > 0 && (i - left) % options.roi != 0) {
+    cv::Mat A = frames[i], B = frames[i-1]; 
+    const Blob &last = chunk->getEndPos(); 
+    Blob next = chunk->predict(i); 
+    int m = std::max(last[1] - last[0], last[3] - last[2]) / 2 + 1 + 
+            options.erode + options.dilate + 1; 
+    cv::Rect window = (cv::Rect(last[0] - m, last[2] - m, 
+                                last[1] - last[0] + 1 + 2*m, 
+                                last[3] - last[2] + 1 + 2*m) | 
+                       cv::Rect(next[0] - m, next[2] - m, 
+                                next[1] - next[0] + 1 + 2*m, 
+                                next[3] - next[2] + 1 + 2*m)) & 
+                      cv::Rect(0, 0, A.cols, A.rows); 
+    if (window.area() > 0 && ws.detect(A, B, window, options) > 0) 
+      return true; 
   }
-
-  if (i > j) 
-    SWAP(i,j); 
-  
-  cout << "Try comparing " << names[i] << " with " << names[j] << endl;
-  read(A, names[i].c_str(), options); 
-  read(B, names[j].c_str(), options); 
-  Blob target = region; 
-  
-  delta(A, B, target);
-  threshold(A, options); 
-  morphology(A, options);
-  getBlobs(A, blobs);
-  bool a = (blobs.size() > 0); 
-  sprintf(outname, "blob-%s-%s.jpg", names[i].c_str(), names[j].c_str());
-  cv::imwrite( outname, A ); 
-
-  return a;
+  return delta(ws, frames, i); 
 }
 
 
-
-int createChunks( vector<string> &names, Chunks &chunks ) 
+int createChunks( Workspace &ws, FrameBuffer &frames, ImageWriter &writer, Chunks &chunks ) 
 /** 
- * Create a list of ranges of activity
+ * Create a list of ranges of activity. Frames are annotated full size, as
+ * decoded again by the writer. The gap before each chunk is checked in 
+ * the background while the scan goes on. 
  */ 
 {
   try 
   {
-    int master=0, left, right, s;
-    Chunk *chunk=NULL, *prev=NULL; 
-    cv::Mat im; 
+    GapChecker gaps( frames, options, options.threads ); 
+    int master=0, left, right, s, prev;
+    const vector<Blob> &blobs = ws.blobs; 
     
     /* Output images with target bounding box drawn. */
     bool tracking = false; 
     Blob lastSeen;
-    char outname[128]; 
+    char outname[512]; 
     
-    for( int i = 1; i < names.size(); i++ ) {
+    for( int i = 1; frames.wait(i); i++ ) {
 		
       /* delta(i-1, i) */
-      if( delta( names[i], names[i-1], im ) ) {
-
-        cout << " * " << names[i] << endl;
-        prev = chunks.back();
-        if (prev) { 
-          chunk = new Chunk(prev); 
-          chunk->setStartPos( im, prev->getEndPos(), i ); 
-        } else {
-          chunk = new Chunk(); 
-          chunk->setStartPos( im, i ); 
-          chunk->gapKnown( true ); /* preceeding gap known to be empty */ 
+      if( delta( ws, frames, i ) ) {
+
+        cout << " * " << frames.name(i) << endl;
+        Chunk chunk; 
+        prev = chunks.size() - 1;
+        if (prev >= 0) 
+          chunk.setStartPos( blobs, chunks.endPos(prev), i ); 
+        else {
+          chunk.setStartPos( blobs, i ); 
+          chunk.gapKnown( true ); /* preceeding gap known to be empty */ 
         }
              
-        sprintf(outname, "tracking-%s", names[i].c_str());
-        drawBoundingBox(names[i].c_str(), outname, 
-                        chunk->getEndPos() * options.shrink_factor); 
+        snprintf(outname, sizeof(outname), "tracking-%s", baseName(frames.name(i)));
+        writer.write(outname, i, chunk.getEndPos() * options.shrink_factor); 
         
         
         /* range where delta != 0. left is first appearance and 
          * right is when it disaappears */ 
         left = i; 
-        for( i++ ; i < names.size() && delta( names[i], names[i-1], im ); i++ ) {
-          cout << " | " << names[i] << endl;
-          chunk->updateTarget( im, i ); 
-          sprintf(outname, "tracking-%s", names[i].c_str());
-          drawBoundingBox(names[i].c_str(), outname, 
-                          chunk->getEndPos() * options.shrink_factor); 
+        for( i++ ; frames.wait(i) && track( ws, frames, i, left, &chunk ); i++ ) {
+          cout << " | " << frames.name(i) << endl;
+          chunk.updateTarget( blobs, i ); 
+          snprintf(outname, sizeof(outname), "tracking-%s", baseName(frames.name(i)));
+          writer.write(outname, i, chunk.getEndPos() * options.shrink_factor); 
         }
         right = --i; 
-        chunk->setStartIndex( left ); 
-        chunk->setEndIndex( right ); 
+        chunk.setStartIndex( left ); 
+        chunk.setEndIndex( right ); 
 
         tracking = true; 
-        lastSeen = chunk->getEndPos(); 
+        lastSeen = chunk.getEndPos(); 
 
         chunks.append( chunk ); 
-        if (prev) {
-          if (targetPersistsOverGap(names, chunks, prev->getEndIndex(), chunk->getStartIndex(), prev->getEndPos()))
-            chunks.mergeWithNext(prev);
-          else {
-            chunk->gapKnown( true ); /* preceeding gap known to be empty */ 
-          }
-        }
+        if (prev >= 0) 
+          gaps.check( chunks ); 
+        gaps.reconcile( chunks ); 
        
       }
       else {
-        cout << "   " << names[i] << endl;
+        cout << "   " << frames.name(i) << endl;
         if (tracking) {
-          sprintf(outname, "tracking-%s", names[i].c_str());
-          drawBoundingBox(names[i].c_str(), outname, 
-                          lastSeen * options.shrink_factor); 
+          snprintf(outname, sizeof(outname), "tracking-%s", baseName(frames.name(i)));
+          writer.write(outname, i, lastSeen * options.shrink_factor); 
         }
       }
     }
+    gaps.reconcile( chunks, true ); 
    
   }
   
@@ -220,41 +225,43 @@ int createChunks( vector<string> &names, Chunks &chunks )
 
 
 
-void printChunks( vector<string> &names, Chunks &chunks ) 
+void printChunks( FrameBuffer &frames, const Chunks &chunks ) 
 {
   int i = 0, j; 
   cout << "\n  Here are the blobs\n";
-  for (Chunk *chunk = chunks.start(); chunk != NULL; chunk = chunks.next()) {
+  for (Chunks::const_iterator chunk = chunks.begin(); chunk != chunks.end(); ++chunk) {
     cout << "\n chunk " << ++i << endl;
-    cout << chunk->getStartPos() << endl;
-    if (chunk->getEndIndex() - chunk->getStartIndex() == 0)
-        cout << names[chunk->getEndIndex()] << endl;
-    else if (chunk->getEndIndex() - chunk->getStartIndex() <= 6) 
-      for (j = chunk->getStartIndex(); j < names.size() && j <= chunk->getEndIndex(); j++) {
-        cout << names[j] << endl;
+    if (chunk->most > 1) 
+      cout << " up to " << chunk->most << " targets at once" << endl;
+    cout << chunks.track(chunk->first).blob << endl;
+    if (chunk->end_index - chunk->start_index == 0)
+        cout << frames.name(chunk->end_index) << endl;
+    else if (chunk->end_index - chunk->start_index <= 6) 
+      for (j = chunk->start_index; j < frames.size() && j <= chunk->end_index; j++) {
+        cout << frames.name(j) << endl;
       }
     else {
-        cout << names[chunk->getStartIndex()] << endl;
-        cout << names[chunk->getStartIndex()+1] << endl;
-        cout << names[chunk->getStartIndex()+2] << endl;
+        cout << frames.name(chunk->start_index) << endl;
+        cout << frames.name(chunk->start_index+1) << endl;
+        cout << frames.name(chunk->start_index+2) << endl;
         cout << "   ...\n"; 
-        cout << names[chunk->getEndIndex()-1] << endl;
-        cout << names[chunk->getEndIndex()] << endl;
+        cout << frames.name(chunk->end_index-1) << endl;
+        cout << frames.name(chunk->end_index) << endl;
       }
-      cout << chunk->getEndPos() << endl;
+      cout << chunks.track(chunk->last - 1).blob << endl;
     }
   cout << endl;
 }
 
-void printTracks( vector<string> &names, Chunks &chunks ) 
+void printTracks( FrameBuffer &frames, const Chunks &chunks ) 
 {
   int i = 0, j; 
   cout << "\n  Here are the tracks\n";
-  for (Chunk *chunk = chunks.start(); chunk != NULL; chunk = chunks.next()) {
+  for (Chunks::const_iterator chunk = chunks.begin(); chunk != chunks.end(); ++chunk) {
     cout << "\n chunk " << ++i << endl;
-    const vector<Track> &tracks = chunk->getTracks();  
-    for (j = 0; j < tracks.size(); j++) {
-      cout << tracks[j].index << ' ' << names[tracks[j].index] << ' ' << tracks[j].blob << endl;
+    for (j = chunk->first; j < chunk->last; j++) {
+      Track track = chunks.track(j); 
+      cout << track.index << ' ' << frames.name(track.index) << ' ' << track.blob << endl;
     }
     
   cout << endl;
@@ -275,14 +282,34 @@ int main(int argc, const char **argv)
     die("error: must specify binary morphology factors");
 
 
-  /* get file names */
+  /* get file names, or open video */
   std::vector<std::string> names; 
-  filenames( names, std::cin );
+  FrameSource *source = openFrames( names, options, std::cin ); 
+
+  /* a live feed ends when we're told to stop */ 
+  if (options.follow[0] != '\0') {
+    signal( SIGINT, DirectoryFrameSource::interrupt ); 
+    signal( SIGTERM, DirectoryFrameSource::interrupt ); 
+  }
+
+  /* decoded frames, each read from disk once and prefetched by a 
+   * pool of workers */ 
+  FrameBuffer frames( *source, 2, options.threads ); 
+
+  /* annotated frames are written in the background */ 
+  ImageWriter writer( frames, options.threads, options.backlog ); 
+
+  /* buffers between the decoded frames and their blobs */ 
+  Workspace ws; 
 
   /* linked list of gaps */ 
   Chunks chunks; 
-  createChunks( names, chunks ); 
-  printTracks( names, chunks ); 
+  createChunks( ws, frames, writer, chunks ); 
+  printTracks( frames, chunks ); 
+
+  if (writer.dropped() > 0) 
+    cerr << "warning: output fell behind, " << writer.dropped() 
+         << " annotated frames dropped\n"; 
 
   return 0; 
 
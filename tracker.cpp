@@ -0,0 +1,356 @@
+/* John Muir Institute for the Environment
+ * University of California, Davis
+ *
+ * tracker.cpp
+ * Following many targets at once from frame to frame. This file is part
+ * of the Salamander project.
+ *
+ * Copyright (C) 2013 Christopher Patton
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tracker.h"
+#include <algorithm>
+#include <cmath>
+#include <assert.h>
+
+#define FAR ((long long)1 << 40) /* cost of a blob outside of the gate */
+
+/* Blob centroids are (row, column) in (x, y). */
+static inline int row( const Blob &b ) { return b.GetCentroidX(); }
+static inline int col( const Blob &b ) { return b.GetCentroidY(); }
+
+
+/**
+ * class Tracker
+ */
+
+Tracker::Tracker( int margin, int patience )
+{
+  this->margin = margin;
+  this->patience = patience;
+  next_id = 0;
+  gain = 0.5;
+} // constr
+
+void Tracker::clear()
+{
+  targets.clear();
+  missed.clear();
+  owners.clear();
+} // clear()
+
+int Tracker::size() const
+{
+  return targets.size();
+} // size()
+
+const Tracker::target_t &Tracker::operator[]( int k ) const
+{
+  return targets[k];
+} // operator[]
+
+int Tracker::find( int id ) const
+{
+  for (int k = 0; k < targets.size(); k++)
+    if (targets[k].id == id)
+      return k;
+  return -1;
+} // find()
+
+int Tracker::owner( int k ) const
+{
+  return owners[k];
+} // owner()
+
+Blob Tracker::predict( int k, int i ) const
+{
+  const target_t &t = targets[k];
+  Blob b = t.blob;
+  int dt = i - t.last;
+  b.shift(floor(t.vi * dt + 0.5), floor(t.vj * dt + 0.5));
+  return b;
+} // predict()
+
+int Tracker::nearest( const Blob &blob ) const
+{
+  int best = -1;
+  long long d, least = 0;
+  for (int k = 0; k < targets.size(); k++) {
+    long long di = row(targets[k].blob) - row(blob),
+              dj = col(targets[k].blob) - col(blob);
+    d = di*di + dj*dj;
+    if (best < 0 || d < least) {
+      best = k;
+      least = d;
+    }
+  }
+  return best;
+} // nearest()
+
+int Tracker::confirmed() const
+{
+  int n = 0;
+  for (int k = 0; k < targets.size(); k++)
+    n += (targets[k].hits > 1);
+  return n;
+} // confirmed()
+
+int Tracker::gate( const target_t &t ) const
+/* Until a target has been seen twice, its velocity isn't known, so it 
+ * might be anywhere further off. */ 
+{
+  const Blob &b = t.blob;
+  int g = std::max(b[1] - b[0], b[3] - b[2]) + 1 + margin;
+  return t.hits > 1 ? g : 3*g;
+} // gate()
+
+int Tracker::_find( int x )
+{
+  while (parent[x] != x) {
+    parent[x] = parent[parent[x]];
+    x = parent[x];
+  }
+  return x;
+} // _find()
+
+void Tracker::update( const std::vector<Blob> &blobs, int i )
+/* Targets that share a candidate compete for it, so they're put in one
+ * cluster, and each cluster is assigned on its own. Most clusters are a
+ * single target, which simply takes its nearest candidate. */
+{
+  int nt = targets.size(), nb = blobs.size(), t, k;
+  owners.assign(nb, -1);
+  matched.assign(nt, -1);
+  column.assign(nb, -1);
+  predicted.resize(nt);
+  for (t = 0; t < nt; t++)
+    predicted[t] = predict(t, i);
+  candidates(blobs);
+
+  parent.resize(nt);
+  for (t = 0; t < nt; t++)
+    parent[t] = t;
+  first.assign(nb, -1);
+  for (k = 0; k < edges.size(); k++) {
+    const edge_t &e = edges[k];
+    if (first[e.blob] < 0)
+      first[e.blob] = e.target;
+    else
+      parent[_find(e.target)] = _find(first[e.blob]);
+  }
+
+  /* Targets by cluster, counting sort on the root. */
+  clusters.assign(nt + 1, 0);
+  for (t = 0; t < nt; t++)
+    clusters[_find(t) + 1]++;
+  for (t = 0; t < nt; t++)
+    clusters[t + 1] += clusters[t];
+  members.resize(nt);
+  cursor.assign(clusters.begin(), clusters.end() - 1);
+  for (t = 0; t < nt; t++)
+    members[cursor[_find(t)]++] = t;
+
+  for (t = 0; t < nt; t++)
+    if (clusters[t + 1] > clusters[t])
+      assign(&members[clusters[t]], clusters[t + 1] - clusters[t]);
+
+  /* Move the targets that were seen, and drop the ones missing too
+   * long. Targets keep their order. */
+  int n = 0;
+  for (t = 0; t < nt; t++) {
+    if (matched[t] >= 0) {
+      const Blob &b = blobs[matched[t]];
+      int dt = std::max(i - targets[t].last, 1);
+      double g = targets[t].hits > 1 ? gain : 1; /* first, from rest */
+      targets[t].vi += g * (row(b) - row(predicted[t])) / dt;
+      targets[t].vj += g * (col(b) - col(predicted[t])) / dt;
+      targets[t].blob = b;
+      targets[t].last = i;
+      targets[t].hits++;
+      missed[t] = 0;
+      owners[matched[t]] = n;
+    }
+    else if (++missed[t] > patience)
+      continue;
+    targets[n] = targets[t];
+    missed[n++] = missed[t];
+  }
+  targets.resize(n);
+  missed.resize(n);
+
+  for (k = 0; k < nb; k++)
+    if (owners[k] < 0) {
+      target_t fresh = { next_id++, blobs[k], i, i, 1, 0, 0 };
+      owners[k] = targets.size();
+      targets.push_back(fresh);
+      missed.push_back(0);
+    }
+} // update()
+
+void Tracker::candidates( const std::vector<Blob> &blobs )
+/* Blobs are sorted into a grid by centroid, with cells about as big as
+ * the average gate, and each target only looks at the cells its gate
+ * around its predicted position overlaps. The grid only covers the
+ * blobs, and is made coarser if there would be many more cells than
+ * blobs. Edges come out sorted by target. */
+{
+  int nt = targets.size(), nb = blobs.size(), t, k;
+  edges.clear();
+  offsets.assign(nt + 1, 0);
+  if (nt == 0 || nb == 0)
+    return;
+
+  int top = row(blobs[0]), bottom = top, left = col(blobs[0]), right = left;
+  for (k = 1; k < nb; k++) {
+    top = std::min(top, row(blobs[k]));
+    bottom = std::max(bottom, row(blobs[k]));
+    left = std::min(left, col(blobs[k]));
+    right = std::max(right, col(blobs[k]));
+  }
+  long sum = 0;
+  for (t = 0; t < nt; t++)
+    sum += gate(targets[t]);
+  int cell = std::max(1L, sum / nt), gw, gh;
+  while (true) {
+    gw = (right - left) / cell + 1;
+    gh = (bottom - top) / cell + 1;
+    if ((long)gw * gh <= 4L * nb + 64)
+      break;
+    cell *= 2;
+  }
+
+  cells.assign(gw * gh + 1, 0);
+  for (k = 0; k < nb; k++)
+    cells[(row(blobs[k]) - top) / cell * gw + (col(blobs[k]) - left) / cell + 1]++;
+  for (k = 0; k < gw * gh; k++)
+    cells[k + 1] += cells[k];
+  order.resize(nb);
+  cursor.assign(cells.begin(), cells.end() - 1);
+  for (k = 0; k < nb; k++)
+    order[cursor[(row(blobs[k]) - top) / cell * gw +
+                 (col(blobs[k]) - left) / cell]++] = k;
+
+  for (t = 0; t < nt; t++) {
+    const Blob &b = predicted[t];
+    long long g = gate(targets[t]);
+    int i0 = row(b) - g - top, i1 = row(b) + g - top,
+        j0 = col(b) - g - left, j1 = col(b) + g - left;
+    if (i1 < 0 || j1 < 0) {
+      offsets[t + 1] = edges.size();
+      continue;
+    }
+    i0 = std::max(i0, 0) / cell;
+    j0 = std::max(j0, 0) / cell;
+    i1 = std::min(i1 / cell, gh - 1);
+    j1 = std::min(j1 / cell, gw - 1);
+    for (int ci = i0; ci <= i1; ci++)
+      for (int cj = j0; cj <= j1; cj++)
+        for (int c = cells[ci*gw + cj]; c < cells[ci*gw + cj + 1]; c++) {
+          k = order[c];
+          long long di = row(blobs[k]) - row(b), dj = col(blobs[k]) - col(b);
+          if (di*di + dj*dj <= g*g) {
+            edge_t e = { t, k, di*di + dj*dj };
+            edges.push_back(e);
+          }
+        }
+    offsets[t + 1] = edges.size();
+  }
+} // candidates()
+
+void Tracker::assign( const int *cluster, int n )
+/* Rows of the cost matrix are the targets, and columns their candidates
+ * and then one column per target for leaving it without a blob. Costs
+ * are squared distances, or the squared gate for going without; blobs
+ * outside of a target's gate, and other targets' columns, are FAR. Every
+ * target can go without, so the best assignment never costs FAR. This is
+ * the O(n^2 m) form of the Hungarian method, with potentials u and v. */
+{
+  int t, k, j, c;
+
+  if (n == 1) { /* the nearest candidate */
+    t = cluster[0];
+    int best = -1;
+    for (k = offsets[t]; k < offsets[t + 1]; k++)
+      if (best < 0 || edges[k].cost < edges[best].cost)
+        best = k;
+    if (best >= 0)
+      matched[t] = edges[best].blob;
+    return;
+  }
+
+  /* Columns of the candidates. No other cluster has them. */
+  cols.clear();
+  for (c = 0; c < n; c++)
+    for (k = offsets[cluster[c]]; k < offsets[cluster[c] + 1]; k++)
+      if (column[edges[k].blob] < 0) {
+        column[edges[k].blob] = cols.size();
+        cols.push_back(edges[k].blob);
+      }
+  int m = cols.size() + n, w = m + 1;
+
+  cost.assign((n + 1) * w, FAR);
+  for (c = 0; c < n; c++) {
+    long long g = gate(targets[cluster[c]]);
+    cost[(c + 1) * w + cols.size() + c + 1] = g*g;
+    for (k = offsets[cluster[c]]; k < offsets[cluster[c] + 1]; k++)
+      cost[(c + 1) * w + column[edges[k].blob] + 1] = edges[k].cost;
+  }
+
+  u.assign(n + 1, 0);
+  v.assign(m + 1, 0);
+  p.assign(m + 1, 0);
+  way.assign(m + 1, 0);
+  for (int r = 1; r <= n; r++) {
+    p[0] = r;
+    int j0 = 0;
+    minv.assign(m + 1, FAR * 4);
+    used.assign(m + 1, false);
+    do {
+      used[j0] = true;
+      int r0 = p[j0], j1 = 0;
+      long long delta = FAR * 4;
+      for (j = 1; j <= m; j++)
+        if (!used[j]) {
+          long long cur = cost[r0 * w + j] - u[r0] - v[j];
+          if (cur < minv[j]) {
+            minv[j] = cur;
+            way[j] = j0;
+          }
+          if (minv[j] < delta) {
+            delta = minv[j];
+            j1 = j;
+          }
+        }
+      for (j = 0; j <= m; j++)
+        if (used[j]) {
+          u[p[j]] += delta;
+          v[j] -= delta;
+        }
+        else
+          minv[j] -= delta;
+      j0 = j1;
+    } while (p[j0] != 0);
+    do {
+      int j1 = way[j0];
+      p[j0] = p[j1];
+      j0 = j1;
+    } while (j0);
+  }
+
+  for (j = 1; j <= cols.size(); j++)
+    if (p[j] && cost[p[j] * w + j] < FAR)
+      matched[cluster[p[j] - 1]] = cols[j - 1];
+} // assign()
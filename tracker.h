@@ -0,0 +1,128 @@
+/* John Muir Institute for the Environment
+ * University of California, Davis
+ *
+ * tracker.h
+ * Following many targets at once from frame to frame. This file is part
+ * of the Salamander project.
+ *
+ * Copyright (C) 2013 Christopher Patton
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACKER_H
+#define TRACKER_H
+
+#include "blobs.h"
+#include <vector>
+
+
+/**
+ * class Tracker - targets followed through the blobs of successive
+ * frames. Each target moves at a constant velocity, from which its
+ * position in the next frame is predicted; the velocity is corrected by
+ * a fixed fraction of how far off the prediction was, as a steady state
+ * Kalman filter (an alpha-beta filter) would. A blob is a candidate for
+ * a target if its centroid is within the target's gate around where it
+ * was predicted to be, the target's larger side plus a margin, or three
+ * times that for a target only seen once, whose velocity is taken whole
+ * from its first move.
+ *
+ * Candidates are found through a grid of blob centroids, so only blobs
+ * near a target are looked at. Targets that compete for blobs are
+ * assigned together with the Hungarian method, minimizing the sum of
+ * squared distances, where leaving a target without a blob costs as much
+ * as its gate. Blobs left over start new targets, and a target without a
+ * blob for more than patience frames is dropped.
+ */
+
+class Tracker {
+public:
+
+  struct target_t {
+    int id;
+    Blob blob;                  /* last position */
+    int first, last;            /* frames first and last seen */
+    int hits;                   /* frames seen */
+    double vi, vj;              /* velocity, rows and columns a frame */
+  };
+
+  Tracker( int margin=8, int patience=2 );
+
+  /* Drop every target. */
+  void clear();
+
+  /* Associate the blobs of frame i with the targets. */
+  void update( const std::vector<Blob> &blobs, int i );
+
+  /* Live targets, oldest first. */
+  int size() const;
+  const target_t &operator[]( int k ) const;
+
+  /* Index of the target with id, or -1 if it was dropped. */
+  int find( int id ) const;
+
+  /* Index of the target blob k of the last update went to. */
+  int owner( int k ) const;
+
+  /* Where target k is expected in frame i: its last position moved on at
+   * its velocity. */ 
+  Blob predict( int k, int i ) const;
+
+  /* Index of the target nearest to blob, or -1 if there are none. */
+  int nearest( const Blob &blob ) const;
+
+  /* Live targets seen in more than one frame. */
+  int confirmed() const;
+
+private:
+
+  /* Candidate blob for a target. */
+  struct edge_t {
+    int target, blob;
+    long long cost;             /* squared distance */
+  };
+
+  int gate( const target_t &t ) const;
+
+  /* Fill edges with the candidates of each target. */
+  void candidates( const std::vector<Blob> &blobs );
+
+  /* Assign the blobs of a cluster of n targets that compete for them. */
+  void assign( const int *cluster, int n );
+
+  int _find( int x );
+
+  int margin, patience, next_id;
+  double gain;                  /* of the velocity */ 
+  std::vector<target_t> targets;
+  std::vector<int> missed;      /* by target, frames since last seen */
+  std::vector<int> owners;      /* by blob */
+
+  /* Scratch, kept from frame to frame */
+  std::vector<int> cells, order, cursor; /* blobs by grid cell */
+  std::vector<edge_t> edges;
+  std::vector<Blob> predicted;  /* by target */
+  std::vector<int> offsets;     /* by target, first of its edges */
+  std::vector<int> parent, first; /* clusters */
+  std::vector<int> clusters, members; /* targets by cluster */
+  std::vector<int> matched;     /* by target, its blob or -1 */
+  std::vector<int> cols, column; /* a cluster's blobs, and back */
+  std::vector<long long> cost, u, v, minv; /* Hungarian method */
+  std::vector<int> p, way;
+  std::vector<bool> used;
+
+};
+
+#endif
@@ -0,0 +1,155 @@
+/* John Muir Institute for the Environment
+ * University of California, Davis
+ *
+ * workspace.cpp
+ * Buffers for processing one stream. This file is part of the Salamander
+ * project.
+ *
+ * Copyright (C) 2013 Christopher Patton
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "workspace.h"
+#include <algorithm>
+
+#define TILE 32                 /* side of the tiles of the change map */
+
+/**
+ * class Workspace
+ */
+
+Workspace::Workspace()
+{
+  rle = blank = false; 
+} // constr
+
+int Workspace::detect( const cv::Mat &A, const cv::Mat &B, 
+                       const param_t &options ) 
+{
+  return find(A, B, cv::Rect(0, 0, A.cols, A.rows), options); 
+} // detect()
+
+int Workspace::detect( const cv::Mat &A, const cv::Mat &B, 
+                       const cv::Rect &window, const param_t &options ) 
+/* Erosion and dilation each only look so far, so pixels of the window's 
+ * mask at least erode + dilate pixels from its edges are the same as the
+ * frame's. A blob whose bounding box keeps one pixel further in has no 
+ * neighbours outside of that, so it's one of the frame's blobs, whole. */
+{
+  find(A, B, window, options); 
+  int g = options.erode + options.dilate + 1; 
+  bool left = window.x > 0, right = window.x + window.width < A.cols, 
+       top = window.y > 0, bottom = window.y + window.height < A.rows; 
+
+  for (int k = 0; k < blobs.size(); k++) {
+    const Blob &b = blobs[k]; 
+    if ((left && b[0] - window.x < g) || 
+        (right && b[1] - window.x >= window.width - g) || 
+        (top && b[2] - window.y < g) || 
+        (bottom && b[3] - window.y >= window.height - g)) 
+      return -1; 
+  }
+  return blobs.size(); 
+} // detect(window)
+
+int Workspace::find( const cv::Mat &A, const cv::Mat &B, 
+                     const cv::Rect &window, const param_t &options ) 
+/* Blobs are copied out of the labeler into a vector that keeps its 
+ * capacity from frame to frame. An idle frame pair stops as soon as the
+ * mask is known to be empty, which for most is right after thresholding;
+ * only a mask with something in it is labeled. 
+ *
+ * With options.tiles, the window is first cut down to the tiles that 
+ * changed. The mask is clear outside of them, so erosion there and 
+ * dilation from them only reach as far as the larger factor: cut down to
+ * the changed tiles plus that much, the window's mask is the same, and so
+ * are its blobs. */ 
+{
+  bool any; 
+  rle = (options.engine == ENGINE_RUNS); 
+  size = A.size(); 
+  region = window; 
+  blobs.clear(); 
+
+  if (options.tiles) {
+    int h = std::max(options.erode, options.dilate); 
+    cv::Rect r = changed(A(window), B(window), TILE, options); 
+    if (r.area() == 0) { 
+      blank = true; 
+      return 0; 
+    }
+    region = cv::Rect(window.x + r.x - h, window.y + r.y - h, 
+                      r.width + 2*h, r.height + 2*h) & window; 
+  }
+
+  cv::Mat a = A(region), b = B(region); 
+  blank = options.cascade && !coarse(a, b, options); 
+  if (blank) 
+    any = false; 
+  else if (rle) {
+    threshold(runs, a, b, options); 
+    if ((any = morphology(runs, options))) 
+      components.label(runs, options.min_volume); 
+  }
+  else {
+    threshold(mask, a, b, options); 
+    if ((any = morphology(mask, options))) 
+      components.label(mask, options.min_volume, options.threads); 
+  }
+
+  if (!any) 
+    return 0; 
+  for (int i = 0; i < components.size(); i++) {
+    blobs.push_back(components[i]); 
+    if (region.size() != size) 
+      blobs.back().fromWindow(region, size.width, size.height); 
+  }
+  return blobs.size(); 
+} // find()
+
+bool Workspace::coarse( const cv::Mat &A, const cv::Mat &B, 
+                       const param_t &options ) 
+/* The grid can be as coarse as the largest square inside the erosion 
+ * element. A small element makes for a grid as fine as the frame, and 
+ * then there's nothing to gain. */ 
+{
+  int stride = innerSquare(elements.get(options.erode, options.shape)); 
+  return stride < 2 || sample(A, B, stride, options); 
+} // coarse()
+
+const cv::Mat &Workspace::image() 
+/* The mask only covers the region that was looked at; the rest of the 
+ * frame is clear. */ 
+{
+  if (!blank && region.size() == size) {
+    if (rle) 
+      runs.toMat(img); 
+    else 
+      mask.toMat(img); 
+    return img; 
+  }
+
+  img.create(size, CV_8UC1); 
+  img = cv::Scalar(0); 
+  if (!blank) {
+    if (rle) 
+      runs.toMat(part); 
+    else 
+      mask.toMat(part); 
+    cv::Mat dst = img(region); 
+    part.copyTo(dst); 
+  }
+  return img; 
+} // image()
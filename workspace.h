@@ -0,0 +1,95 @@
+/* John Muir Institute for the Environment
+ * University of California, Davis
+ *
+ * workspace.h
+ * Buffers for processing one stream. The pipeline needs the same buffers
+ * for every frame, so they're made once and reused rather than allocated
+ * frame after frame. This file is part of the Salamander project.
+ *
+ * Copyright (C) 2013 Christopher Patton
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WORKSPACE_H
+#define WORKSPACE_H
+
+#include "salamander.h"
+#include "blobs.h"
+#include "mask.h"
+#include "runs.h"
+#include <vector>
+
+
+/**
+ * class Workspace - everything between a pair of decoded frames and their
+ * blobs: the thresholded delta (a BitMask, or a RunMask for ENGINE_RUNS),
+ * the morphology scratch that goes with it,
+ * the labeler's label and component storage, and the blobs. Buffers grow
+ * to fit the first frames and are reused after that, so processing frames
+ * of the same size doesn't touch the heap. Decoded frames live in the 
+ * FrameBuffer, which recycles its slots the same way. 
+ *
+ * One workspace serves one stream on one thread. 
+ */
+
+class Workspace {
+public:
+
+  Workspace(); 
+
+  /* Threshold the delta of A and B into a mask, clean it up with binary 
+   * morphology and find its blobs. Return the number of blobs. With 
+   * options.cascade, a sample of the delta is looked at first, and the 
+   * rest is skipped if it shows there can't be any. With options.tiles,
+   * only the part of the frame around the tiles that changed is. */
+  int detect( const cv::Mat &A, const cv::Mat &B, const param_t &options ); 
+
+  /* detect() in a window of A and B, with the blobs in the coordinates
+   * of the frame. Return -1 if a blob comes near an edge of the window 
+   * inside the frame, where it may differ from the frame's. */ 
+  int detect( const cv::Mat &A, const cv::Mat &B, const cv::Rect &window,
+              const param_t &options ); 
+
+  /* The mask as an 8-bit image, for output. */ 
+  const cv::Mat &image(); 
+
+  BitMask mask; 
+  RunMask runs; 
+  std::vector<Blob> blobs; 
+  cv::Mat A, B;                 /* frames decoded outside of the buffer */ 
+
+private:
+
+  /* detect() in a window of the frame, with the blobs in the frame's
+   * coordinates. */ 
+  int find( const cv::Mat &A, const cv::Mat &B, const cv::Rect &window, 
+            const param_t &options ); 
+
+  /* The coarse stage of the cascade. Return false if no blob can be 
+   * found in the delta of A and B. */ 
+  bool coarse( const cv::Mat &A, const cv::Mat &B, const param_t &options ); 
+
+  MaskComponents components; 
+  Elements elements; 
+  cv::Mat img;                  /* mask as an 8-bit image */ 
+  cv::Mat part;                 /* mask of the region */ 
+  bool rle;                     /* last mask was runs */ 
+  bool blank;                   /* nothing in the last delta was looked at */
+  cv::Size size;                /* of the last delta */ 
+  cv::Rect region;              /* of it that the mask covers */ 
+
+};
+
+#endif
@@ -0,0 +1,167 @@
+/* John Muir Institute for the Environment
+ * University of California, Davis
+ *
+ * writer.cpp
+ * Output of annotated frames off of the processing thread. This file is
+ * part of the Salamander project.
+ *
+ * Copyright (C) 2013 Christopher Patton
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "writer.h"
+#include <iostream>
+#include <cstring>
+#include <assert.h>
+
+/**
+ * class ImageWriter
+ */
+
+ImageWriter::ImageWriter( FrameBuffer &frames, int threads, int capacity )
+  : frames(frames)
+{
+  assert(threads >= 0 && capacity >= 0);
+  if (capacity == 0)
+    threads = 0;
+  if (threads == 0)
+    capacity = 0;
+
+  jobs.resize(capacity);
+  states.resize(capacity, FREE);
+  head = tail = 0;
+  drops = 0;
+  stop = false;
+
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&queued, NULL);
+
+  workers.resize(threads);
+  for (int i = 0; i < threads; i++)
+    pthread_create(&workers[i], NULL, &ImageWriter::work, this);
+} // constr
+
+ImageWriter::~ImageWriter()
+{
+  pthread_mutex_lock(&lock);
+  stop = true;
+  pthread_cond_broadcast(&queued);
+  pthread_mutex_unlock(&lock);
+
+  for (int i = 0; i < workers.size(); i++)
+    pthread_join(workers[i], NULL);
+
+  pthread_cond_destroy(&queued);
+  pthread_mutex_destroy(&lock);
+} // destr
+
+bool ImageWriter::write( const char *out, int i, const Blob &blob )
+/* Fill the job at the tail of the ring and queue it. Only this thread
+ * fills jobs, and workers leave free ones alone, so it's filled outside 
+ * of the lock. A job that is still queued or being written means the 
+ * ring is full. */
+{
+  if (workers.empty()) {
+    output(out, i, blob, canvas);
+    return true;
+  }
+
+  pthread_mutex_lock(&lock);
+  int slot = tail;
+  if (states[slot] != FREE) {
+    drops++;
+    pthread_mutex_unlock(&lock);
+    return false;
+  }
+  pthread_mutex_unlock(&lock);
+
+  job_t &job = jobs[slot];
+  strncpy(job.out, out, sizeof(job.out) - 1);
+  job.out[sizeof(job.out) - 1] = '\0';
+  job.i = i;
+  job.blob = blob;
+
+  pthread_mutex_lock(&lock);
+  states[slot] = QUEUED;
+  tail = (tail + 1) % jobs.size();
+  pthread_cond_signal(&queued);
+  pthread_mutex_unlock(&lock);
+  return true;
+} // write()
+
+int ImageWriter::dropped() const
+{
+  pthread_mutex_lock(&lock);
+  int n = drops;
+  pthread_mutex_unlock(&lock);
+  return n;
+} // dropped()
+
+void ImageWriter::output( const char *out, int i, const Blob &blob, 
+                          cv::Mat &canvas )
+{
+  frames.original(canvas, i);
+  if (canvas.empty())
+    std::cerr << "can't read " << frames.name(i) << std::endl;
+  else if (!drawBoundingBox(canvas, out, blob))
+    std::cerr << "can't write " << out << std::endl;
+} // output()
+
+void *ImageWriter::work( void *arg )
+{
+  ((ImageWriter *)arg)->work();
+  return NULL;
+} // work()
+
+void ImageWriter::work()
+/* Take the job at the head of the ring and write it outside of the lock.
+ * On stop, keep going until the ring is empty. */
+{
+  int slot;
+  cv::Mat canvas;
+
+  pthread_mutex_lock(&lock);
+  while (true) {
+    while (!stop && states[head] != QUEUED)
+      pthread_cond_wait(&queued, &lock);
+    if (states[head] != QUEUED)
+      break;
+
+    slot = head;
+    head = (head + 1) % jobs.size();
+    states[slot] = WRITING;
+    pthread_mutex_unlock(&lock);
+
+    try {
+      output(jobs[slot].out, jobs[slot].i, jobs[slot].blob, canvas);
+    }
+    catch( cv::Exception &e ) {
+      std::cerr << "can't write " << jobs[slot].out << ": "
+                << e.what() << std::endl;
+    }
+    catch( std::exception &e ) {
+      std::cerr << "can't write " << jobs[slot].out << ": "
+                << e.what() << std::endl;
+    }
+    catch( ... ) {
+      std::cerr << "can't write " << jobs[slot].out << ": "
+                << "unknown exception" << std::endl;
+    }
+
+    pthread_mutex_lock(&lock);
+    states[slot] = FREE;
+  }
+  pthread_mutex_unlock(&lock);
+} // work()
@@ -0,0 +1,97 @@
+/* John Muir Institute for the Environment
+ * University of California, Davis
+ *
+ * writer.h
+ * Output of annotated frames off of the processing thread. Encoding and
+ * writing a JPEG costs more than processing a shrunk frame, so the tracker
+ * hands frames to a pool of writers and moves on. This file is part of
+ * the Salamander project.
+ *
+ * Copyright (C) 2013 Christopher Patton
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include "salamander.h"
+#include "blobs.h"
+#include "frames.h"
+#include <vector>
+#include <pthread.h>
+
+
+/**
+ * class ImageWriter - a bounded queue of frames to be output with a
+ * bounding box drawn on them, drained by a pool of workers. A job only 
+ * holds the frame's index; the worker decodes the frame as is (color, 
+ * full size) with FrameBuffer::original(), so the caller never waits on
+ * the decoding either. The box is in the coordinates of the full size 
+ * frame. If every job is taken, the frame is dropped rather than have 
+ * the caller wait on the disk. Frames are taken up in the order they 
+ * were queued.
+ *
+ * With no workers or no buffers, frames are written on the calling
+ * thread. Only one thread may queue frames. The destructor writes out
+ * whatever is still queued.
+ */
+
+class ImageWriter {
+public:
+
+  ImageWriter( FrameBuffer &frames, int threads, int capacity );
+  ~ImageWriter();
+
+  /* Queue frame i for output to out with blob drawn on it. Return false
+   * if the frame was dropped. */
+  bool write( const char *out, int i, const Blob &blob );
+
+  /* Number of frames dropped so far. */
+  int dropped() const;
+
+private:
+
+  enum state_t { FREE, QUEUED, WRITING };
+
+  struct job_t {
+    char out [512];
+    int i;
+    Blob blob;
+  };
+
+  /* Decode frame i into canvas, draw blob on it and output it. */
+  void output( const char *out, int i, const Blob &blob, cv::Mat &canvas );
+
+  /* Worker */
+  static void *work( void *arg );
+  void work();
+
+  FrameBuffer &frames;
+  std::vector<job_t> jobs;      /* ring of jobs */
+  std::vector<state_t> states;
+  int head;                     /* next job to write */
+  int tail;                     /* next buffer to fill */
+  int drops;
+  bool stop;
+
+  cv::Mat canvas;               /* annotated frame, when not threaded */
+
+  std::vector<pthread_t> workers;
+  mutable pthread_mutex_t lock;
+  pthread_cond_t queued;        /* a job was queued */
+
+};
+
+#endif